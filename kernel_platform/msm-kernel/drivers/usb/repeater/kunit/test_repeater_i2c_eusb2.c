@@ -0,0 +1,641 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for the eUSB2 i2c repeater driver
+ *
+ * Included by repeater-i2c-eusb2.c so that the static driver code can be
+ * exercised directly. The i2c bus is replaced with an emulated register
+ * file which counts bus transactions, one per i2c transfer on real
+ * hardware.
+ */
+
+#include <kunit/test.h>
+
+struct eusb2_test_emu {
+	u8		regs[EUSB2_REG_CNT];
+	/* contents after power on or reset */
+	u8		defaults[EUSB2_REG_CNT];
+	/* registers ignoring writes, like a block which does not latch */
+	DECLARE_BITMAP(stuck, EUSB2_REG_CNT);
+	/* registers the chip clears when they are read */
+	DECLARE_BITMAP(clear_on_read, EUSB2_REG_CNT);
+	/* registers read over the bus */
+	DECLARE_BITMAP(read_regs, EUSB2_REG_CNT);
+	unsigned int	reads;
+	unsigned int	writes;
+	unsigned int	reg_writes;
+};
+
+struct eusb2_test_ctx {
+	struct device		*dev;
+	struct eusb2_repeater	*er;
+	struct eusb2_test_emu	emu;
+	bool			registered;
+	ktime_t			start;
+};
+
+static void eusb2_test_emu_write(struct eusb2_test_emu *emu, unsigned int reg,
+		const u8 *val, size_t len)
+{
+	size_t i;
+
+	emu->writes++;
+	for (i = 0; i < len && reg + i < EUSB2_REG_CNT; i++) {
+		emu->reg_writes++;
+		if (!test_bit(reg + i, emu->stuck))
+			emu->regs[reg + i] = val[i];
+	}
+}
+
+static int eusb2_test_bus_write(void *context, const void *data, size_t count)
+{
+	const u8 *buf = data;
+
+	if (count < 2)
+		return -EINVAL;
+
+	eusb2_test_emu_write(context, buf[0], buf + 1, count - 1);
+	return 0;
+}
+
+static int eusb2_test_bus_gather_write(void *context, const void *reg,
+		size_t reg_len, const void *val, size_t val_len)
+{
+	eusb2_test_emu_write(context, *(const u8 *)reg, val, val_len);
+	return 0;
+}
+
+static int eusb2_test_bus_read(void *context, const void *reg_buf,
+		size_t reg_size, void *val_buf, size_t val_size)
+{
+	struct eusb2_test_emu *emu = context;
+	unsigned int reg = *(const u8 *)reg_buf;
+	u8 *val = val_buf;
+	size_t i;
+
+	if (reg + val_size > EUSB2_REG_CNT)
+		return -EINVAL;
+
+	emu->reads++;
+	bitmap_set(emu->read_regs, reg, val_size);
+	for (i = 0; i < val_size; i++) {
+		val[i] = emu->regs[reg + i];
+		if (test_bit(reg + i, emu->clear_on_read))
+			emu->regs[reg + i] = 0;
+	}
+
+	return 0;
+}
+
+static const struct regmap_bus eusb2_test_bus = {
+	.write = eusb2_test_bus_write,
+	.gather_write = eusb2_test_bus_gather_write,
+	.read = eusb2_test_bus_read,
+	.reg_format_endian_default = REGMAP_ENDIAN_NATIVE,
+	.val_format_endian_default = REGMAP_ENDIAN_NATIVE,
+};
+
+/* the repeater was power cycled or reset */
+static void eusb2_test_emu_reset(struct eusb2_test_emu *emu)
+{
+	memcpy(emu->regs, emu->defaults, sizeof(emu->regs));
+}
+
+/* <val reg> pairs standing in for qcom,param-override-seq */
+static const u8 eusb2_test_nxp_seq[][2] = {
+	{ 0x11, LINK_CONTROL1 },
+	{ 0x21, eUSB2_RX_CONTROL },
+	{ 0x22, eUSB2_TX_CONTROL },
+	{ 0x23, USB2_RX_CONTROL },
+	{ 0x24, USB2_TX_CONTROL1 },
+	{ 0x25, USB2_TX_CONTROL2 },
+	{ 0x31, USB2_HS_DISCONNECT_THRESHOLD },
+};
+
+static const u8 eusb2_test_ti_seq[][2] = {
+	{ 0x11, GPIO0_CONFIG },
+	{ 0x21, UART_PORT1 },
+	{ 0x22, EXTRA_PORT1 },
+	{ 0x31, GLOBAL_CONFIG },
+};
+
+/* same as eusb2_repeater_parse_seq(), without the devicetree */
+static int eusb2_test_build_seq(struct eusb2_repeater *er, const u8 (*seq)[2],
+		int cnt)
+{
+	DECLARE_BITMAP(used, EUSB2_REG_CNT);
+	struct eusb2_seq_entry image[EUSB2_REG_CNT];
+	int i, reg;
+
+	bitmap_zero(used, EUSB2_REG_CNT);
+	eusb2_repeater_seed_image(er, image, used);
+
+	for (i = 0; i < cnt; i++) {
+		reg = seq[i][1];
+		image[reg].reg = reg;
+		image[reg].mask = EUSB2_SEQ_MASK;
+		image[reg].val = seq[i][0];
+		__set_bit(reg, used);
+	}
+
+	return eusb2_repeater_build_seq(er, image, used, &er->override_seq);
+}
+
+static int eusb2_test_init(struct kunit *test, enum eusb2_repeater_type type,
+		const u8 (*seq)[2], int cnt)
+{
+	struct eusb2_test_ctx *ctx;
+	struct eusb2_repeater *er;
+	struct regmap_config cfg;
+	int ret;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	test->priv = ctx;
+
+	ctx->dev = root_device_register("eusb2_repeater_test");
+	if (IS_ERR(ctx->dev))
+		return PTR_ERR(ctx->dev);
+
+	er = eusb2_repeater_alloc(ctx->dev);
+	if (!er)
+		return -ENOMEM;
+	ctx->er = er;
+	er->chip = &repeater_chip[type];
+	dev_set_drvdata(ctx->dev, er);
+
+	/* chip id survives resets, tells real and lost state apart */
+	ctx->emu.defaults[type == NXP_REPEATER ? REVISION_ID : REV_ID] = 0x01;
+	if (type == TI_REPEATER)
+		bitmap_set(ctx->emu.clear_on_read, INT_STATUS_1,
+				INT_STATUS_2 - INT_STATUS_1 + 1);
+	eusb2_test_emu_reset(&ctx->emu);
+
+	eusb2_repeater_regmap_config(er, &cfg);
+	er->regmap = devm_regmap_init(ctx->dev, &eusb2_test_bus, &ctx->emu, &cfg);
+	if (IS_ERR(er->regmap))
+		return PTR_ERR(er->regmap);
+
+	/* no supplies in the test device node, these are dummy regulators */
+	er->supplies[EUSB2_VDD18].supply = "vdd18";
+	er->supplies[EUSB2_VDD3].supply = "vdd3";
+	ret = devm_regulator_bulk_get(ctx->dev, EUSB2_NUM_SUPPLIES, er->supplies);
+	if (ret)
+		return ret;
+	er->vdd18 = er->supplies[EUSB2_VDD18].consumer;
+	er->vdd3 = er->supplies[EUSB2_VDD3].consumer;
+
+	ret = eusb2_test_build_seq(er, seq, cnt);
+	if (ret)
+		return ret;
+
+	ret = eusb2_repeater_register(er);
+	if (ret)
+		return ret;
+	ctx->registered = true;
+
+	return 0;
+}
+
+static int eusb2_test_nxp_init(struct kunit *test)
+{
+	return eusb2_test_init(test, NXP_REPEATER, eusb2_test_nxp_seq,
+			ARRAY_SIZE(eusb2_test_nxp_seq));
+}
+
+static int eusb2_test_ti_init(struct kunit *test)
+{
+	return eusb2_test_init(test, TI_REPEATER, eusb2_test_ti_seq,
+			ARRAY_SIZE(eusb2_test_ti_seq));
+}
+
+static void eusb2_test_exit(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+
+	if (!ctx || IS_ERR_OR_NULL(ctx->dev))
+		return;
+
+	if (ctx->registered)
+		eusb2_repeater_unregister(ctx->er);
+	root_device_unregister(ctx->dev);
+}
+
+/* start counting bus transactions for the next operation */
+static void eusb2_test_mark(struct eusb2_test_ctx *ctx)
+{
+	ctx->emu.reads = 0;
+	ctx->emu.writes = 0;
+	ctx->emu.reg_writes = 0;
+	ctx->start = ktime_get();
+}
+
+static void eusb2_test_report(struct kunit *test, const char *op)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+
+	kunit_info(test, "%s %s: %u reads, %u writes (%u regs) in %lld us\n",
+		ctx->er->chip->name, op, ctx->emu.reads, ctx->emu.writes,
+		ctx->emu.reg_writes, ktime_us_delta(ktime_get(), ctx->start));
+}
+
+/* the emulated registers hold the override sequence */
+static void eusb2_test_expect_seq(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_seq *cs = &ctx->er->override_seq;
+	int i;
+
+	for (i = 0; i < cs->cnt; i++)
+		KUNIT_EXPECT_EQ(test, ctx->emu.regs[cs->entry[i].reg], cs->entry[i].val);
+}
+
+static void eusb2_test_power_on(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+
+	KUNIT_ASSERT_EQ(test, usb_repeater_powerup(&ctx->er->ur), 0);
+	KUNIT_ASSERT_EQ(test, usb_repeater_init(&ctx->er->ur), 0);
+}
+
+/* one transfer per burst and per single register, nothing when programmed */
+static void eusb2_test_init_bursts(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_seq *cs = &ctx->er->override_seq;
+
+	KUNIT_ASSERT_EQ(test, usb_repeater_powerup(&ctx->er->ur), 0);
+
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_init(&ctx->er->ur), 0);
+	eusb2_test_report(test, "init");
+	KUNIT_EXPECT_EQ(test, ctx->emu.writes,
+			(unsigned int)(cs->burst_cnt + cs->single_cnt));
+	KUNIT_EXPECT_EQ(test, ctx->emu.reg_writes, (unsigned int)cs->cnt);
+	eusb2_test_expect_seq(test);
+
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_init(&ctx->er->ur), 0);
+	eusb2_test_report(test, "init again");
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads, 0U);
+	KUNIT_EXPECT_EQ(test, ctx->emu.writes, 0U);
+}
+
+/* cached state goes back to the chip in one sync after a power cycle */
+static void eusb2_test_power_cycle(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_repeater *er = ctx->er;
+
+	eusb2_test_power_on(test);
+
+	er->autosuspend_delay_ms = 0;
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_powerdown(&er->ur), 0);
+	eusb2_test_report(test, "powerdown");
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads + ctx->emu.writes, 0U);
+	KUNIT_EXPECT_FALSE(test, er->power_enabled);
+
+	eusb2_test_emu_reset(&ctx->emu);
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_powerup(&er->ur), 0);
+	eusb2_test_report(test, "powerup");
+	KUNIT_EXPECT_GT(test, ctx->emu.writes, 0U);
+	KUNIT_EXPECT_LE(test, ctx->emu.writes, (unsigned int)er->override_seq.cnt);
+	eusb2_test_expect_seq(test);
+
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_init(&er->ur), 0);
+	eusb2_test_report(test, "init after powerup");
+	eusb2_test_expect_seq(test);
+}
+
+/* a powerup within the autosuspend delay costs no bus traffic */
+static void eusb2_test_powerdown_absorbed(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_repeater *er = ctx->er;
+
+	eusb2_test_power_on(test);
+
+	er->autosuspend_delay_ms = 1000;
+	KUNIT_EXPECT_EQ(test, usb_repeater_powerdown(&er->ur), 0);
+
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_powerup(&er->ur), 0);
+	KUNIT_EXPECT_EQ(test, usb_repeater_init(&er->ur), 0);
+	eusb2_test_report(test, "absorbed powerup and init");
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads + ctx->emu.writes, 0U);
+	KUNIT_EXPECT_EQ(test, er->powerdown_absorbed, 1U);
+	KUNIT_EXPECT_EQ(test, er->powerdown_cnt, 0U);
+	KUNIT_EXPECT_TRUE(test, er->power_enabled);
+}
+
+/*
+ * Repeated reset requests reach the gpio once, and the chip is only
+ * touched after the ready time, by the first register access.
+ */
+static void eusb2_test_reset_coalesce(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_repeater *er = ctx->er;
+	ktime_t start;
+
+	eusb2_test_power_on(test);
+
+	er->reset_ready_us = 200;
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_reset(&er->ur, false), 0);
+	KUNIT_EXPECT_EQ(test, usb_repeater_reset(&er->ur, false), 0);
+	eusb2_test_emu_reset(&ctx->emu);
+	start = ktime_get();
+	KUNIT_EXPECT_EQ(test, usb_repeater_reset(&er->ur, true), 0);
+	KUNIT_EXPECT_EQ(test, usb_repeater_reset(&er->ur, true), 0);
+	KUNIT_EXPECT_EQ(test, er->reset_asserts, 1U);
+	KUNIT_EXPECT_EQ(test, er->reset_releases, 1U);
+	KUNIT_EXPECT_EQ(test, er->reset_coalesced, 2U);
+	KUNIT_EXPECT_EQ(test, (int)er->reset_state, (int)EUSB2_RESET_RELEASING);
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads + ctx->emu.writes, 0U);
+
+	KUNIT_EXPECT_EQ(test, usb_repeater_init(&er->ur), 0);
+	eusb2_test_report(test, "reset and init");
+	KUNIT_EXPECT_GE(test, ktime_us_delta(ktime_get(), start), (s64)er->reset_ready_us);
+	KUNIT_EXPECT_EQ(test, (int)er->reset_state, (int)EUSB2_RESET_READY);
+	eusb2_test_expect_seq(test);
+}
+
+/* the saved blob rebuilds the same sequence, damaged blobs change nothing */
+static void eusb2_test_calib(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_repeater *er = ctx->er;
+	struct eusb2_seq saved = er->override_seq;
+	struct eusb2_calib_hdr *hdr;
+	size_t len;
+	u8 *blob;
+
+	blob = kunit_kzalloc(test, EUSB2_CALIB_MAX_LEN, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, blob);
+
+	len = eusb2_calib_build(er, blob);
+	hdr = (void *)blob;
+	KUNIT_EXPECT_EQ(test, le32_to_cpu(hdr->magic), (u32)EUSB2_CALIB_MAGIC);
+	KUNIT_EXPECT_EQ(test, len, sizeof(*hdr) + le16_to_cpu(hdr->len));
+	KUNIT_EXPECT_EQ(test, le32_to_cpu(hdr->crc),
+			crc32_le(0, blob + sizeof(*hdr), len - sizeof(*hdr)));
+
+	KUNIT_EXPECT_EQ(test, eusb2_calib_parse(er, blob + sizeof(*hdr),
+			len - sizeof(*hdr) - 1), -EINVAL);
+	KUNIT_EXPECT_EQ(test, er->override_seq.entry, saved.entry);
+
+	memset(&er->override_seq, 0, sizeof(er->override_seq));
+	KUNIT_ASSERT_EQ(test, eusb2_calib_parse(er, blob + sizeof(*hdr),
+			len - sizeof(*hdr)), 0);
+	KUNIT_ASSERT_EQ(test, er->override_seq.cnt, saved.cnt);
+	KUNIT_EXPECT_EQ(test, memcmp(er->override_seq.entry, saved.entry,
+			saved.cnt * sizeof(*saved.entry)), 0);
+
+	eusb2_test_power_on(test);
+	eusb2_test_expect_seq(test);
+}
+
+/* the dump reads only readable registers, map holes are not writeable */
+static void eusb2_test_regs_dump(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_repeater *er = ctx->er;
+	struct seq_file m = {
+		.size = PAGE_SIZE,
+		.private = er,
+	};
+	int reg;
+
+	m.buf = kunit_kzalloc(test, m.size, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, m.buf);
+
+	eusb2_test_power_on(test);
+
+	bitmap_zero(ctx->emu.read_regs, EUSB2_REG_CNT);
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, eusb2_repeater_regs_show(&m, NULL), 0);
+	eusb2_test_report(test, "regs dump");
+	kunit_info(test, "%.*s", (int)m.count, m.buf);
+
+	for_each_set_bit(reg, ctx->emu.read_regs, EUSB2_REG_CNT) {
+		KUNIT_EXPECT_TRUE(test, eusb2_repeater_reg_readable(er, reg));
+		KUNIT_EXPECT_FALSE(test, eusb2_repeater_reg_precious(er, reg));
+	}
+
+	KUNIT_EXPECT_FALSE(test, eusb2_repeater_reg_writeable(er, 0x30));
+	KUNIT_EXPECT_NE(test, regmap_write(er->regmap, 0x30, 0x01), 0);
+	KUNIT_EXPECT_EQ(test, ctx->emu.regs[0x30], (u8)0);
+
+	/* a repeater that is off is not read */
+	er->autosuspend_delay_ms = 0;
+	KUNIT_EXPECT_EQ(test, usb_repeater_powerdown(&er->ur), 0);
+	m.count = 0;
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, eusb2_repeater_regs_show(&m, NULL), 0);
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads, 0U);
+}
+
+/* key registers are compared on resume, state is rewritten only if lost */
+static void eusb2_test_system_resume(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_repeater *er = ctx->er;
+
+	eusb2_test_power_on(test);
+
+	KUNIT_ASSERT_EQ(test, eusb2_repeater_pm_suspend(ctx->dev), 0);
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, eusb2_repeater_pm_resume(ctx->dev), 0);
+	eusb2_test_report(test, "resume, state kept");
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads, (unsigned int)er->chip->n_pm_check);
+	KUNIT_EXPECT_EQ(test, ctx->emu.writes, 0U);
+	KUNIT_EXPECT_EQ(test, er->resume_kept, 1U);
+
+	KUNIT_ASSERT_EQ(test, eusb2_repeater_pm_suspend(ctx->dev), 0);
+	eusb2_test_emu_reset(&ctx->emu);
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, eusb2_repeater_pm_resume(ctx->dev), 0);
+	eusb2_test_report(test, "resume, state lost");
+	KUNIT_EXPECT_EQ(test, er->resume_restored, 1U);
+	eusb2_test_expect_seq(test);
+}
+
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+static void eusb2_test_tune_load(struct eusb2_repeater *er, const u8 (*seq)[2],
+		int cnt)
+{
+	DECLARE_BITMAP(used, EUSB2_REG_CNT);
+	u8 val[EUSB2_REG_CNT];
+	int i;
+
+	bitmap_zero(used, EUSB2_REG_CNT);
+	for (i = 0; i < cnt; i++) {
+		val[seq[i][1]] = seq[i][0];
+		__set_bit(seq[i][1], used);
+	}
+
+	mutex_lock(&er->hw_lock);
+	eusb2_repeater_tune_update(er, used, val);
+	mutex_unlock(&er->hw_lock);
+}
+
+static int eusb2_test_tune_apply(struct eusb2_repeater *er)
+{
+	const struct eusb2_tune_table *t;
+	int ret;
+
+	mutex_lock(&er->hw_lock);
+	t = eusb2_repeater_tune_table(er);
+	ret = eusb2_repeater_tune_apply(er, t, t->used);
+	mutex_unlock(&er->hw_lock);
+
+	return ret;
+}
+
+/*
+ * NXP: 0x05-0x06 and 0x09, read back in one span. TI: 0x40 and 0x50-0x51,
+ * the map hole in between splits the read back in two.
+ */
+static const u8 eusb2_test_nxp_tune[][2] = {
+	{ 0x41, eUSB2_TX_CONTROL },
+	{ 0x42, USB2_RX_CONTROL },
+	{ 0x43, USB2_HS_TERMINATION },
+};
+
+static const u8 eusb2_test_ti_tune[][2] = {
+	{ 0x41, GPIO1_CONFIG },
+	{ 0x42, UART_PORT1 },
+	{ 0x43, EXTRA_PORT1 },
+};
+
+static void eusb2_test_tune(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_repeater *er = ctx->er;
+	const u8 (*tune)[2];
+	unsigned int spans;
+	int i, stuck;
+
+	if (er->chip == &repeater_chip[NXP_REPEATER]) {
+		tune = eusb2_test_nxp_tune;
+		spans = 1;
+	} else {
+		tune = eusb2_test_ti_tune;
+		spans = 2;
+	}
+
+	eusb2_test_power_on(test);
+	eusb2_test_tune_load(er, tune, 3);
+
+	/* one burst plus one single write, one read per span to verify */
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, eusb2_test_tune_apply(er), 0);
+	eusb2_test_report(test, "tune, batch");
+	KUNIT_EXPECT_EQ(test, ctx->emu.writes, 2U);
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads, spans);
+	for (i = 0; i < 3; i++)
+		KUNIT_EXPECT_EQ(test, ctx->emu.regs[tune[i][1]], tune[i][0]);
+
+	er->tune_verify = EUSB2_TUNE_VERIFY_PER_WRITE;
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, eusb2_test_tune_apply(er), 0);
+	eusb2_test_report(test, "tune, per-write");
+	KUNIT_EXPECT_EQ(test, ctx->emu.writes, 3U);
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads, 3U);
+
+	/* a register which does not latch is retried, then reported */
+	stuck = tune[2][1];
+	ctx->emu.regs[stuck] = 0;
+	__set_bit(stuck, ctx->emu.stuck);
+	er->tune_verify = EUSB2_TUNE_VERIFY_BATCH;
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, eusb2_test_tune_apply(er), -EIO);
+	eusb2_test_report(test, "tune, batch, stuck register");
+	KUNIT_EXPECT_EQ(test, ctx->emu.writes, 4U);
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads, spans + 2);
+	__clear_bit(stuck, ctx->emu.stuck);
+}
+#endif
+
+/* retention is kept or restored depending on the signature register */
+static void eusb2_test_retention(struct kunit *test)
+{
+	struct eusb2_test_ctx *ctx = test->priv;
+	struct eusb2_repeater *er = ctx->er;
+
+	eusb2_test_power_on(test);
+
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_retention(&er->ur, true), 0);
+	KUNIT_EXPECT_EQ(test, usb_repeater_retention(&er->ur, false), 0);
+	eusb2_test_report(test, "retention, state kept");
+	KUNIT_EXPECT_EQ(test, ctx->emu.writes, 1U);
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads, 1U);
+	KUNIT_EXPECT_EQ(test, er->retention_kept, 1U);
+
+	KUNIT_EXPECT_EQ(test, usb_repeater_retention(&er->ur, true), 0);
+	eusb2_test_emu_reset(&ctx->emu);
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_retention(&er->ur, false), 0);
+	eusb2_test_report(test, "retention, state lost");
+	KUNIT_EXPECT_EQ(test, er->retention_lost, 1U);
+	eusb2_test_expect_seq(test);
+
+	/* a powerup in retention leaves it like a retention exit */
+	KUNIT_EXPECT_EQ(test, usb_repeater_retention(&er->ur, true), 0);
+	eusb2_test_mark(ctx);
+	KUNIT_EXPECT_EQ(test, usb_repeater_powerup(&er->ur), 0);
+	eusb2_test_report(test, "powerup in retention");
+	KUNIT_EXPECT_FALSE(test, er->in_retention);
+	KUNIT_EXPECT_EQ(test, ctx->emu.reads, 1U);
+	KUNIT_EXPECT_EQ(test, er->retention_kept, 2U);
+}
+
+static struct kunit_case eusb2_test_nxp_cases[] = {
+	KUNIT_CASE(eusb2_test_init_bursts),
+	KUNIT_CASE(eusb2_test_power_cycle),
+	KUNIT_CASE(eusb2_test_powerdown_absorbed),
+	KUNIT_CASE(eusb2_test_reset_coalesce),
+	KUNIT_CASE(eusb2_test_calib),
+	KUNIT_CASE(eusb2_test_regs_dump),
+	KUNIT_CASE(eusb2_test_system_resume),
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	KUNIT_CASE(eusb2_test_tune),
+#endif
+	KUNIT_CASE(eusb2_test_retention),
+	{}
+};
+
+static struct kunit_case eusb2_test_ti_cases[] = {
+	KUNIT_CASE(eusb2_test_init_bursts),
+	KUNIT_CASE(eusb2_test_power_cycle),
+	KUNIT_CASE(eusb2_test_powerdown_absorbed),
+	KUNIT_CASE(eusb2_test_reset_coalesce),
+	KUNIT_CASE(eusb2_test_calib),
+	KUNIT_CASE(eusb2_test_regs_dump),
+	KUNIT_CASE(eusb2_test_system_resume),
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	KUNIT_CASE(eusb2_test_tune),
+#endif
+	{}
+};
+
+static struct kunit_suite eusb2_test_nxp_suite = {
+	.name = "eusb2_repeater_nxp",
+	.init = eusb2_test_nxp_init,
+	.exit = eusb2_test_exit,
+	.test_cases = eusb2_test_nxp_cases,
+};
+
+static struct kunit_suite eusb2_test_ti_suite = {
+	.name = "eusb2_repeater_ti",
+	.init = eusb2_test_ti_init,
+	.exit = eusb2_test_exit,
+	.test_cases = eusb2_test_ti_cases,
+};
+
+kunit_test_suites(&eusb2_test_nxp_suite, &eusb2_test_ti_suite);
@@ -0,0 +1,485 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for the usb repeater framework
+ */
+
+#include <kunit/test.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/notifier.h>
+#include <linux/of.h>
+#include <linux/slab.h>
+#include <linux/usb/repeater.h>
+#include <linux/workqueue.h>
+
+#define TEST_REPEATER_CNT	4
+#define TEST_LOOKUP_THREADS	4
+#define TEST_ADD_REMOVE_LOOPS	200
+
+struct test_repeater {
+	struct usb_repeater	ur;
+	struct device_node	*node;
+	bool			added;
+	int			ret;
+	unsigned int		ops[USB_REPEATER_OP_CNT];
+
+	/* init op blocks until released, for usb_repeater_init_async() */
+	bool			block_init;
+	struct completion	init_release;
+};
+
+struct test_lookup_thread {
+	struct test_ctx		*ctx;
+	struct task_struct	*task;
+	struct device		*consumer;
+	unsigned int		lookups;
+	unsigned int		found;
+	unsigned int		errors;
+	u64			ns;
+};
+
+struct test_ctx {
+	struct kunit			*test;
+	struct device_driver		drv;
+	struct device			*consumer;
+	struct test_repeater		rep[TEST_REPEATER_CNT];
+	struct test_lookup_thread	thread[TEST_LOOKUP_THREADS];
+	struct delayed_work		add_work;
+	struct notifier_block		nb;
+	unsigned int			nb_add;
+	unsigned int			nb_remove;
+};
+
+static int test_repeater_op(struct usb_repeater *ur, enum usb_repeater_op op)
+{
+	struct test_repeater *t = container_of(ur, struct test_repeater, ur);
+
+	t->ops[op]++;
+	return t->ret;
+}
+
+static int test_repeater_reset(struct usb_repeater *ur, bool bring_out_of_reset)
+{
+	return test_repeater_op(ur, USB_REPEATER_OP_RESET);
+}
+
+static int test_repeater_init(struct usb_repeater *ur)
+{
+	struct test_repeater *t = container_of(ur, struct test_repeater, ur);
+
+	if (t->block_init)
+		wait_for_completion(&t->init_release);
+
+	return test_repeater_op(ur, USB_REPEATER_OP_INIT);
+}
+
+static int test_repeater_powerup(struct usb_repeater *ur)
+{
+	return test_repeater_op(ur, USB_REPEATER_OP_POWERUP);
+}
+
+static int test_repeater_powerdown(struct usb_repeater *ur)
+{
+	return test_repeater_op(ur, USB_REPEATER_OP_POWERDOWN);
+}
+
+static int test_repeater_add(struct test_repeater *t)
+{
+	int ret;
+
+	ret = usb_add_repeater_dev(&t->ur);
+	if (!ret)
+		t->added = true;
+
+	return ret;
+}
+
+static void test_repeater_remove(struct test_repeater *t)
+{
+	usb_remove_repeater_dev(&t->ur);
+	t->added = false;
+}
+
+/* look up @node on behalf of @consumer and drop the reference again */
+static struct usb_repeater *test_repeater_lookup(struct device *consumer,
+		struct device_node *node)
+{
+	struct usb_repeater *r;
+	void *grp;
+
+	grp = devres_open_group(consumer, NULL, GFP_KERNEL);
+	if (!grp)
+		return ERR_PTR(-ENOMEM);
+
+	r = devm_usb_get_repeater_by_node(consumer, node);
+	devres_release_group(consumer, grp);
+
+	return r;
+}
+
+static void test_add_work(struct work_struct *w)
+{
+	struct test_ctx *ctx = container_of(to_delayed_work(w), struct test_ctx,
+			add_work);
+
+	test_repeater_add(&ctx->rep[0]);
+}
+
+static int test_usb_repeater_init(struct kunit *test)
+{
+	struct test_ctx *ctx;
+	struct test_repeater *t;
+	char name[32];
+	int i;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx);
+	ctx->test = test;
+	test->priv = ctx;
+
+	/* lookups pin the driver module of the repeater */
+	ctx->drv.name = "usb_repeater_test";
+	ctx->drv.owner = THIS_MODULE;
+
+	INIT_DELAYED_WORK(&ctx->add_work, test_add_work);
+
+	ctx->consumer = root_device_register("usb_repeater_test_consumer");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx->consumer);
+
+	for (i = 0; i < TEST_REPEATER_CNT; i++) {
+		t = &ctx->rep[i];
+		t->node = kunit_kzalloc(test, sizeof(*t->node), GFP_KERNEL);
+		KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->node);
+
+		scnprintf(name, sizeof(name), "usb_repeater_test%d", i);
+		t->ur.dev = root_device_register(name);
+		KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->ur.dev);
+		t->ur.dev->of_node = t->node;
+		t->ur.dev->driver = &ctx->drv;
+
+		t->ur.reset = test_repeater_reset;
+		t->ur.init = test_repeater_init;
+		t->ur.powerup = test_repeater_powerup;
+		t->ur.powerdown = test_repeater_powerdown;
+		init_completion(&t->init_release);
+	}
+
+	return 0;
+}
+
+static void test_lookup_threads_stop(struct test_ctx *ctx)
+{
+	struct test_lookup_thread *th;
+	int i;
+
+	for (i = 0; i < TEST_LOOKUP_THREADS; i++) {
+		th = &ctx->thread[i];
+		if (!IS_ERR_OR_NULL(th->task))
+			kthread_stop(th->task);
+		th->task = NULL;
+		if (!IS_ERR_OR_NULL(th->consumer))
+			root_device_unregister(th->consumer);
+		th->consumer = NULL;
+	}
+}
+
+static void test_usb_repeater_exit(struct kunit *test)
+{
+	struct test_ctx *ctx = test->priv;
+	struct test_repeater *t;
+	int i;
+
+	if (!ctx)
+		return;
+
+	test_lookup_threads_stop(ctx);
+	cancel_delayed_work_sync(&ctx->add_work);
+
+	for (i = 0; i < TEST_REPEATER_CNT; i++) {
+		t = &ctx->rep[i];
+		if (IS_ERR_OR_NULL(t->ur.dev))
+			continue;
+		if (t->added)
+			test_repeater_remove(t);
+		t->ur.dev->driver = NULL;
+		t->ur.dev->of_node = NULL;
+		root_device_unregister(t->ur.dev);
+	}
+
+	if (!IS_ERR_OR_NULL(ctx->consumer))
+		root_device_unregister(ctx->consumer);
+}
+
+static void test_usb_repeater_add_remove(struct kunit *test)
+{
+	struct test_ctx *ctx = test->priv;
+	struct test_repeater *t = &ctx->rep[0];
+	struct usb_repeater *r;
+
+	r = test_repeater_lookup(ctx->consumer, t->node);
+	KUNIT_EXPECT_EQ(test, PTR_ERR(r), (long)-EPROBE_DEFER);
+
+	KUNIT_ASSERT_EQ(test, test_repeater_add(t), 0);
+	r = test_repeater_lookup(ctx->consumer, t->node);
+	KUNIT_EXPECT_PTR_EQ(test, r, &t->ur);
+
+	/* only the node of a registered repeater matches */
+	r = test_repeater_lookup(ctx->consumer, ctx->rep[1].node);
+	KUNIT_EXPECT_EQ(test, PTR_ERR(r), (long)-EPROBE_DEFER);
+
+	test_repeater_remove(t);
+	r = test_repeater_lookup(ctx->consumer, t->node);
+	KUNIT_EXPECT_EQ(test, PTR_ERR(r), (long)-EPROBE_DEFER);
+}
+
+static int test_lookup_thread_fn(void *data)
+{
+	struct test_lookup_thread *th = data;
+	struct test_ctx *ctx = th->ctx;
+	struct test_repeater *t;
+	struct usb_repeater *r;
+	ktime_t start;
+
+	while (!kthread_should_stop()) {
+		t = &ctx->rep[th->lookups % TEST_REPEATER_CNT];
+
+		start = ktime_get();
+		r = test_repeater_lookup(th->consumer, t->node);
+		th->ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		th->lookups++;
+
+		if (!IS_ERR(r) && r == &t->ur)
+			th->found++;
+		else if (PTR_ERR(r) != -EPROBE_DEFER)
+			th->errors++;
+
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/*
+ * Lookups walk the table under RCU while repeaters come and go. They may
+ * only ever see the repeater belonging to the node, or -EPROBE_DEFER.
+ */
+static void test_usb_repeater_lookup_race(struct kunit *test)
+{
+	struct test_ctx *ctx = test->priv;
+	struct test_lookup_thread *th;
+	unsigned int lookups = 0, found = 0, errors = 0;
+	char name[40];
+	u64 ns = 0;
+	int i;
+
+	for (i = 1; i < TEST_REPEATER_CNT; i++)
+		KUNIT_ASSERT_EQ(test, test_repeater_add(&ctx->rep[i]), 0);
+
+	for (i = 0; i < TEST_LOOKUP_THREADS; i++) {
+		th = &ctx->thread[i];
+		th->ctx = ctx;
+		scnprintf(name, sizeof(name), "usb_repeater_test_lookup%d", i);
+		th->consumer = root_device_register(name);
+		KUNIT_ASSERT_NOT_ERR_OR_NULL(test, th->consumer);
+		th->task = kthread_run(test_lookup_thread_fn, th, "rptr_lookup%d", i);
+		KUNIT_ASSERT_NOT_ERR_OR_NULL(test, th->task);
+	}
+
+	for (i = 0; i < TEST_ADD_REMOVE_LOOPS; i++) {
+		KUNIT_EXPECT_EQ(test, test_repeater_add(&ctx->rep[0]), 0);
+		usleep_range(50, 100);
+		test_repeater_remove(&ctx->rep[0]);
+	}
+
+	test_lookup_threads_stop(ctx);
+	for (i = 0; i < TEST_LOOKUP_THREADS; i++) {
+		th = &ctx->thread[i];
+		lookups += th->lookups;
+		found += th->found;
+		errors += th->errors;
+		ns += th->ns;
+	}
+
+	KUNIT_EXPECT_EQ(test, errors, 0U);
+	KUNIT_EXPECT_GT(test, found, 0U);
+	kunit_info(test, "%u lookups (%u found) against %d add/remove, avg %llu ns\n",
+		lookups, found, TEST_ADD_REMOVE_LOOPS,
+		lookups ? div_u64(ns, lookups) : 0);
+}
+
+static void test_usb_repeater_lookup_timeout(struct kunit *test)
+{
+	struct test_ctx *ctx = test->priv;
+	struct test_repeater *t = &ctx->rep[0];
+	struct usb_repeater *r;
+	ktime_t start;
+	void *grp;
+
+	grp = devres_open_group(ctx->consumer, NULL, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, grp);
+
+	r = devm_usb_get_repeater_by_node_timeout(ctx->consumer, t->node,
+			msecs_to_jiffies(10));
+	KUNIT_EXPECT_EQ(test, PTR_ERR(r), (long)-EPROBE_DEFER);
+
+	schedule_delayed_work(&ctx->add_work, msecs_to_jiffies(20));
+
+	start = ktime_get();
+	r = devm_usb_get_repeater_by_node_timeout(ctx->consumer, t->node,
+			msecs_to_jiffies(1000));
+	KUNIT_EXPECT_PTR_EQ(test, r, &t->ur);
+	kunit_info(test, "repeater found after %lld us\n",
+		ktime_us_delta(ktime_get(), start));
+
+	devres_release_group(ctx->consumer, grp);
+}
+
+static int test_notifier(struct notifier_block *nb, unsigned long event, void *data)
+{
+	struct test_ctx *ctx = container_of(nb, struct test_ctx, nb);
+
+	if (data != &ctx->rep[0].ur)
+		return NOTIFY_DONE;
+
+	if (event == USB_REPEATER_ADD)
+		ctx->nb_add++;
+	else if (event == USB_REPEATER_REMOVE)
+		ctx->nb_remove++;
+
+	return NOTIFY_OK;
+}
+
+static void test_usb_repeater_notifier(struct kunit *test)
+{
+	struct test_ctx *ctx = test->priv;
+
+	KUNIT_ASSERT_EQ(test, test_repeater_add(&ctx->rep[0]), 0);
+
+	/* already registered repeaters are replayed */
+	ctx->nb.notifier_call = test_notifier;
+	KUNIT_ASSERT_EQ(test, usb_register_repeater_notifier(&ctx->nb), 0);
+	KUNIT_EXPECT_EQ(test, ctx->nb_add, 1U);
+
+	test_repeater_remove(&ctx->rep[0]);
+	KUNIT_EXPECT_EQ(test, ctx->nb_remove, 1U);
+
+	KUNIT_ASSERT_EQ(test, test_repeater_add(&ctx->rep[0]), 0);
+	KUNIT_EXPECT_EQ(test, ctx->nb_add, 2U);
+
+	usb_unregister_repeater_notifier(&ctx->nb);
+}
+
+static void test_usb_repeater_op_stats(struct kunit *test)
+{
+	struct test_ctx *ctx = test->priv;
+	struct test_repeater *t = &ctx->rep[0];
+	struct usb_repeater *r = &t->ur;
+	struct usb_repeater_op_stats *os;
+
+	KUNIT_ASSERT_EQ(test, test_repeater_add(t), 0);
+
+	KUNIT_EXPECT_EQ(test, usb_repeater_reset(r, true), 0);
+	KUNIT_EXPECT_EQ(test, usb_repeater_init(r), 0);
+	KUNIT_EXPECT_EQ(test, usb_repeater_powerdown(r), 0);
+	KUNIT_EXPECT_EQ(test, usb_repeater_powerup(r), 0);
+
+	/* ops the driver does not implement are no-ops */
+	KUNIT_EXPECT_EQ(test, usb_repeater_suspend(r, 1), 0);
+	KUNIT_EXPECT_EQ(test, usb_repeater_retention(r, true), 0);
+
+	t->ret = -EIO;
+	KUNIT_EXPECT_EQ(test, usb_repeater_init(r), -EIO);
+	t->ret = 0;
+
+	KUNIT_EXPECT_EQ(test, t->ops[USB_REPEATER_OP_INIT], 2U);
+	os = &r->stats.op[USB_REPEATER_OP_INIT];
+	KUNIT_EXPECT_EQ(test, os->calls, 2ULL);
+	KUNIT_EXPECT_EQ(test, os->errors, 1ULL);
+	KUNIT_EXPECT_EQ(test, r->stats.op[USB_REPEATER_OP_SUSPEND].calls, 0ULL);
+	KUNIT_EXPECT_EQ(test, r->stats.power_cycles, 1ULL);
+
+	usb_repeater_stat_xfer(r, -EIO, 1);
+	KUNIT_EXPECT_EQ(test, r->stats.xfer_errors, 1ULL);
+	KUNIT_EXPECT_EQ(test, r->stats.xfer_retries, 1ULL);
+
+	kunit_info(test, "init avg %llu ns max %llu ns\n",
+		div64_u64(os->total_ns, os->calls), os->max_ns);
+}
+
+static void test_usb_repeater_power_refcount(struct kunit *test)
+{
+	struct test_ctx *ctx = test->priv;
+	struct test_repeater *t = &ctx->rep[0];
+	struct usb_repeater *r = &t->ur;
+	int i;
+
+	KUNIT_ASSERT_EQ(test, test_repeater_add(t), 0);
+
+	/* a failed first powerup takes no reference */
+	t->ret = -EIO;
+	KUNIT_EXPECT_EQ(test, usb_repeater_power_get(r), -EIO);
+	KUNIT_EXPECT_EQ(test, r->power_users, 0U);
+	t->ret = 0;
+
+	for (i = 0; i < 3; i++)
+		KUNIT_EXPECT_EQ(test, usb_repeater_power_get(r), 0);
+	KUNIT_EXPECT_EQ(test, t->ops[USB_REPEATER_OP_POWERUP], 2U);
+	KUNIT_EXPECT_EQ(test, r->power_users, 3U);
+
+	for (i = 0; i < 2; i++)
+		KUNIT_EXPECT_EQ(test, usb_repeater_power_put(r), 0);
+	KUNIT_EXPECT_EQ(test, t->ops[USB_REPEATER_OP_POWERDOWN], 0U);
+
+	KUNIT_EXPECT_EQ(test, usb_repeater_power_put(r), 0);
+	KUNIT_EXPECT_EQ(test, t->ops[USB_REPEATER_OP_POWERDOWN], 1U);
+	KUNIT_EXPECT_EQ(test, r->power_users, 0U);
+}
+
+static void test_usb_repeater_init_async(struct kunit *test)
+{
+	struct test_ctx *ctx = test->priv;
+	struct test_repeater *t = &ctx->rep[0];
+	struct usb_repeater *r = &t->ur;
+
+	KUNIT_ASSERT_EQ(test, test_repeater_add(t), 0);
+
+	/* nothing started yet */
+	KUNIT_EXPECT_EQ(test, usb_repeater_init_wait(r), 0);
+
+	t->block_init = true;
+	t->ret = -ETIMEDOUT;
+	KUNIT_EXPECT_EQ(test, usb_repeater_init_async(r), 0);
+	KUNIT_EXPECT_EQ(test, usb_repeater_init_async(r), -EBUSY);
+
+	complete(&t->init_release);
+	KUNIT_EXPECT_EQ(test, usb_repeater_init_wait(r), -ETIMEDOUT);
+	KUNIT_EXPECT_EQ(test, t->ops[USB_REPEATER_OP_INIT], 1U);
+	t->ret = 0;
+}
+
+static struct kunit_case usb_repeater_test_cases[] = {
+	KUNIT_CASE(test_usb_repeater_add_remove),
+	KUNIT_CASE(test_usb_repeater_lookup_race),
+	KUNIT_CASE(test_usb_repeater_lookup_timeout),
+	KUNIT_CASE(test_usb_repeater_notifier),
+	KUNIT_CASE(test_usb_repeater_op_stats),
+	KUNIT_CASE(test_usb_repeater_power_refcount),
+	KUNIT_CASE(test_usb_repeater_init_async),
+	{}
+};
+
+static struct kunit_suite usb_repeater_test_suite = {
+	.name = "usb_repeater",
+	.init = test_usb_repeater_init,
+	.exit = test_usb_repeater_exit,
+	.test_cases = usb_repeater_test_cases,
+};
+
+kunit_test_suites(&usb_repeater_test_suite);
+
+MODULE_LICENSE("GPL v2");
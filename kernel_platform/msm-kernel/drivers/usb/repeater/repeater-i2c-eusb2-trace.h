@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM eusb2_repeater
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE repeater-i2c-eusb2-trace
+
+#if !defined(__EUSB2_REPEATER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __EUSB2_REPEATER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(eusb2_repeater_xfer,
+	TP_PROTO(const char *name, const char *op, u8 reg, u16 val, int ret,
+		u8 retry),
+	TP_ARGS(name, op, reg, val, ret, retry),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__string(op, op)
+		__field(u8, reg)
+		__field(u16, val)
+		__field(int, ret)
+		__field(u8, retry)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__assign_str(op, op);
+		__entry->reg = reg;
+		__entry->val = val;
+		__entry->ret = ret;
+		__entry->retry = retry;
+	),
+	TP_printk("%s: %s reg=0x%02x val=0x%02x ret=%d retry=%u",
+		__get_str(name), __get_str(op), __entry->reg, __entry->val,
+		__entry->ret, __entry->retry)
+);
+
+DECLARE_EVENT_CLASS(eusb2_repeater_op_template,
+	TP_PROTO(const char *name, const char *op, int arg),
+	TP_ARGS(name, op, arg),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__string(op, op)
+		__field(int, arg)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__assign_str(op, op);
+		__entry->arg = arg;
+	),
+	TP_printk("%s: %s %d", __get_str(name), __get_str(op), __entry->arg)
+);
+
+/* arg is the op argument, e.g. bring_out_of_reset */
+DEFINE_EVENT(eusb2_repeater_op_template, eusb2_repeater_op_start,
+	TP_PROTO(const char *name, const char *op, int arg),
+	TP_ARGS(name, op, arg)
+);
+
+/* arg is the op return value */
+DEFINE_EVENT(eusb2_repeater_op_template, eusb2_repeater_op_end,
+	TP_PROTO(const char *name, const char *op, int arg),
+	TP_ARGS(name, op, arg)
+);
+
+#endif /* __EUSB2_REPEATER_TRACE_H */
+
+/* this part has to be here */
+#include <trace/define_trace.h>
@@ -4,10 +4,15 @@
  */
 
 #include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/crc32.h>
 #include <linux/err.h>
+#include <linux/firmware.h>
 #include <linux/i2c.h>
 #include <linux/gpio/consumer.h>
+#include <linux/hrtimer.h>
 #include <linux/interrupt.h>
+#include <linux/jiffies.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/pinctrl/consumer.h>
@@ -15,12 +20,19 @@
 #include <linux/power_supply.h>
 #include <linux/of.h>
 #include <linux/of_irq.h>
+#include <linux/rcupdate.h>
 #include <linux/regmap.h>
 #include <linux/qti-regmap-debugfs.h>
 #include <linux/regulator/consumer.h>
+#include <linux/sched/clock.h>
 #include <linux/types.h>
 #include <linux/usb/repeater.h>
+#include <linux/workqueue.h>
+
+#define CREATE_TRACE_POINTS
+#include "repeater-i2c-eusb2-trace.h"
 #if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+#include <linux/idr.h>
 #include <linux/sec_class.h>
 #include <linux/mutex.h>
 #endif
@@ -28,10 +40,18 @@
 #define EUSB2_3P0_VOL_MIN			3075000 /* uV */
 #define EUSB2_3P0_VOL_MAX			3300000 /* uV */
 #define EUSB2_3P0_HPM_LOAD			3500	/* uA */
+#define EUSB2_3P0_LPM_LOAD			0	/* uA */
 
 #define EUSB2_1P8_VOL_MIN			1800000 /* uV */
 #define EUSB2_1P8_VOL_MAX			1800000 /* uV */
 #define EUSB2_1P8_HPM_LOAD			32000	/* uA */
+#define EUSB2_1P8_LPM_LOAD			0	/* uA */
+
+enum eusb2_repeater_supply {
+	EUSB2_VDD18,
+	EUSB2_VDD3,
+	EUSB2_NUM_SUPPLIES,
+};
 
 /* NXP PTN3222 eUSB2 repeater registers */
 #define RESET_CONTROL			0x01
@@ -69,44 +89,23 @@
 #if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
 #define ADDRESS_START eUSB2_RX_CONTROL
 #define ADDRESS_END USB2_HS_DISCONNECT_THRESHOLD
-#define TUNE_BUF_COUNT 20
-#define TUNE_BUF_SIZE 25
-#define TUNE_MAX_NXP 17
-#define TUNE_MAX_TI 12
-
-static u8 tune_map_nxp[TUNE_MAX_NXP] = {
-	RESET_CONTROL,
-	LINK_CONTROL1,
-	LINK_CONTROL2,
-	eUSB2_RX_CONTROL,
-	eUSB2_TX_CONTROL,
-	USB2_RX_CONTROL,
-	USB2_TX_CONTROL1,
-	USB2_TX_CONTROL2,
-	USB2_HS_TERMINATION,
-	USB2_HS_DISCONNECT_THRESHOLD,
-	RAP_SIGNATURE,
-	DEVICE_STATUS,
-	LINK_STATUS,
-	REVISION_ID,
-	CHIP_ID_0,
-	CHIP_ID_1,
-	CHIP_ID_2,
-};
-
-static u8 tune_map_ti[TUNE_MAX_TI] = {
-	GPIO0_CONFIG,
-	GPIO1_CONFIG,
-	UART_PORT1,
-	EXTRA_PORT1,
-	REV_ID,
-	GLOBAL_CONFIG,
-	INT_ENABLE_1,
-	INT_ENABLE_2,
-	BC_CONTROL,
-	BC_STATUS_1,
-	INT_STATUS_1,
-	INT_STATUS_2,
+
+/* registers shown by the tuning node, in display order */
+static const struct regmap_range eusb2_nxp_dump_ranges[] = {
+	regmap_reg_range(RESET_CONTROL, USB2_HS_DISCONNECT_THRESHOLD),
+	regmap_reg_range(RAP_SIGNATURE, RAP_SIGNATURE),
+	regmap_reg_range(DEVICE_STATUS, LINK_STATUS),
+	regmap_reg_range(REVISION_ID, CHIP_ID_2),
+};
+
+static const struct regmap_range eusb2_ti_dump_ranges[] = {
+	regmap_reg_range(GPIO0_CONFIG, GPIO0_CONFIG),
+	regmap_reg_range(GPIO1_CONFIG, GPIO1_CONFIG),
+	regmap_reg_range(UART_PORT1, EXTRA_PORT1),
+	regmap_reg_range(REV_ID, REV_ID),
+	regmap_reg_range(GLOBAL_CONFIG, INT_ENABLE_2),
+	regmap_reg_range(BC_CONTROL, BC_STATUS_1),
+	/* INT_STATUS_x clear on read, reading them here would eat irq events */
 };
 #endif
 
@@ -115,32 +114,208 @@ enum eusb2_repeater_type {
 	NXP_REPEATER,
 };
 
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+/* how tuning writes are checked, see eusb2_repeater_tune_apply() */
+enum eusb2_tune_verify {
+	EUSB2_TUNE_VERIFY_NONE,
+	EUSB2_TUNE_VERIFY_BATCH,
+	EUSB2_TUNE_VERIFY_PER_WRITE,
+};
+
+static const char * const eusb2_tune_verify_names[] = {
+	[EUSB2_TUNE_VERIFY_NONE]	= "none",
+	[EUSB2_TUNE_VERIFY_BATCH]	= "batch",
+	[EUSB2_TUNE_VERIFY_PER_WRITE]	= "per-write",
+};
+#endif
+
+#define EUSB2_REG_CNT			256
+
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+/* tuning values indexed by register, replaced as a whole on update */
+struct eusb2_tune_table {
+	struct rcu_head		rcu;
+	DECLARE_BITMAP(used, EUSB2_REG_CNT);
+	u8			val[EUSB2_REG_CNT];
+};
+#endif
+#define EUSB2_RESET_IRQ_IGNORE_MS	20
+#define EUSB2_SEQ_MAX_BURST		16
+#define EUSB2_PM_CHECK_MAX		4
+
+#define EUSB2_XFER_LOG_CNT		256
+
+enum eusb2_xfer_op {
+	EUSB2_XFER_READ,
+	EUSB2_XFER_WRITE,
+	EUSB2_XFER_BULK_READ,
+	EUSB2_XFER_BULK_WRITE,
+	EUSB2_XFER_MULTI_WRITE,
+	EUSB2_XFER_SYNC,
+};
+
+/* register transaction, val is the register count for bulk transfers */
+struct eusb2_xfer_rec {
+	u64	ts;
+	int	ret;
+	u16	val;
+	u8	op;
+	u8	reg;
+	u8	retry;
+};
+
+/* register is written with val | (current value & mask) */
+struct eusb2_seq_entry {
+	u8	reg;
+	u8	mask;
+	u8	val;
+};
+
+/* run of consecutive registers written with one auto-increment transfer */
+struct eusb2_seq_burst {
+	u8	reg;
+	u8	len;
+	u8	idx;
+};
+
+/* DT override sequence compiled at probe, see eusb2_repeater_parse_seq() */
+struct eusb2_seq {
+	struct eusb2_seq_entry	*entry;
+	int			cnt;
+	bool			rmw;
+	u8			*buf;
+	struct eusb2_seq_burst	*burst;
+	int			burst_cnt;
+	struct reg_sequence	*single;
+	int			single_cnt;
+};
+
+struct eusb2_repeater;
+
+/* optional chip specific hooks, any of them may be NULL */
+struct i2c_repeater_chip_ops {
+	/* @val must not be written to @reg in the current mode */
+	bool (*skip_write)(struct eusb2_repeater *er, u8 reg, u8 val);
+};
+
+/*
+ * Everything the driver needs to know about a repeater vendor. A new
+ * vendor is supported by adding an entry to repeater_chip[].
+ */
 struct i2c_repeater_chip {
-	enum eusb2_repeater_type repeater_type;
+	const char *name;
+	/* register map holes are neither read nor written */
+	const struct regmap_access_table *rd_table;
+	const struct regmap_access_table *wr_table;
+	const struct regmap_access_table *volatile_table;
+	const struct regmap_access_table *precious_table;
+	/* register loaded with a marker to detect state loss in retention */
+	bool has_sig;
+	u8 sig_reg;
+	/* written on init before any DT override, may be empty */
+	const struct reg_sequence *init_image;
+	int init_image_cnt;
+	/*
+	 * reset pulse width and time from reset release or power on until
+	 * registers are accessible. No chip has defaults yet, without the
+	 * qcom,reset-assert-us and qcom,reset-ready-us DT properties there
+	 * is no wait at all.
+	 */
+	unsigned int reset_assert_us;
+	unsigned int reset_ready_us;
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	/* contiguous register runs of the tuning dump, read in one burst each */
+	const struct regmap_range *dump_ranges;
+	int n_dump_ranges;
+#endif
+	/* id and key registers compared across system suspend */
+	u8 pm_check[EUSB2_PM_CHECK_MAX];
+	int n_pm_check;
+	const struct i2c_repeater_chip_ops *ops;
+};
+
+/*
+ * RELEASING: out of reset or freshly powered, registers are served from
+ * the cache until reset_ready completes after reset_ready_us.
+ */
+enum eusb2_reset_state {
+	EUSB2_RESET_READY,
+	EUSB2_RESET_ASSERTED,
+	EUSB2_RESET_RELEASING,
 };
 
+/*
+ * Locking: hw_lock serialises everything that changes the chip or the
+ * driver's view of it, the repeater ops, powerdown work, interrupt
+ * threads, system pm and tuning writes. It is never held while waiting
+ * for powerdown_work. Counters are read locklessly by sysfs, the tuning
+ * table is published with RCU so readers do not take hw_lock either.
+ */
 struct eusb2_repeater {
 	struct device			*dev;
 	struct usb_repeater		ur;
+	struct mutex			hw_lock;
 	struct regmap			*regmap;
 	const struct i2c_repeater_chip	*chip;
 	u16				reg_base;
+	struct regulator_bulk_data	supplies[EUSB2_NUM_SUPPLIES];
 	struct regulator		*vdd18;
 	struct regulator		*vdd3;
 	bool				power_enabled;
 
+	/* powerdown is deferred by this long to absorb cable flapping */
+	u32				autosuspend_delay_ms;
+	struct delayed_work		powerdown_work;
+	unsigned int			powerdown_cnt;
+	unsigned int			powerdown_absorbed;
+
+	bool				in_retention;
+	u8				retention_sig;
+	unsigned int			retention_kept;
+	unsigned int			retention_lost;
+
+	/* pm_check registers as read on system suspend */
+	bool				pm_snap_valid;
+	u8				pm_snap[EUSB2_PM_CHECK_MAX];
+	unsigned int			resume_kept;
+	unsigned int			resume_restored;
+
 	struct gpio_desc		*reset_gpiod;
 	int				reset_gpio_irq;
-	u8				*param_override_seq;
-	u8				param_override_seq_cnt;
+	unsigned long			reset_toggled;
+	enum eusb2_reset_state		reset_state;
+	u32				reset_assert_us;
+	u32				reset_ready_us;
+	ktime_t				reset_asserted;
+	struct hrtimer			reset_timer;
+	struct completion		reset_ready;
+	unsigned int			reset_asserts;
+	unsigned int			reset_releases;
+	unsigned int			reset_coalesced;
+	unsigned int			unexpected_resets;
+	struct work_struct		late_init_work;
+	struct dentry			*debugfs_root;
+	struct eusb2_xfer_rec		xfer_log[EUSB2_XFER_LOG_CNT];
+	atomic_t			xfer_head;
+	struct eusb2_seq		override_seq;
 #if IS_ENABLED(CONFIG_USB_NOTIFIER)
-	u8				*param_host_override_seq;
-	u8				param_host_override_seq_cnt;
+	struct eusb2_seq		host_override_seq;
+	struct eusb2_seq		client_to_host_seq;
+	struct eusb2_seq		host_to_client_seq;
 #endif
+	/* sequence the repeater is known to be programmed with, if any */
+	struct eusb2_seq		*programmed_seq;
+	/* override sequences came from the calibration blob, not DT */
+	bool				calib_loaded;
 #if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
-	struct mutex	er_tune_lock;
-	int				tune_buf_cnt;
-	u8				tune_buf[TUNE_BUF_COUNT][2];
+	/* tuning values from the calibration blob, seed the tuning table */
+	struct eusb2_seq_entry		*calib_tune;
+	int				calib_tune_cnt;
+	int				tune_id;
+	struct device			*tune_dev;
+	/* replayed in register order on init, replaced under hw_lock */
+	struct eusb2_tune_table __rcu	*tune;
+	enum eusb2_tune_verify		tune_verify;
 	bool			er_tune_init_done;
 #endif
 };
@@ -149,417 +324,1950 @@ static const struct regmap_config eusb2_i2c_regmap = {
 	.reg_bits = 8,
 	.val_bits = 8,
 	.max_register = 0xff,
+	.cache_type = REGCACHE_RBTREE,
 };
 
-#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
-	struct eusb2_repeater *ter = NULL;
-#endif
+/*
+ * status registers are updated by hardware and must never be cached, nor
+ * may a cache sync replay a write to the reset control register
+ */
+static const struct regmap_range eusb2_nxp_volatile_ranges[] = {
+	regmap_reg_range(RESET_CONTROL, RESET_CONTROL),
+	regmap_reg_range(DEVICE_STATUS, LINK_STATUS),
+};
 
-#undef dev_dbg
-#define dev_dbg dev_err
+static const struct regmap_access_table eusb2_nxp_volatile_table = {
+	.yes_ranges = eusb2_nxp_volatile_ranges,
+	.n_yes_ranges = ARRAY_SIZE(eusb2_nxp_volatile_ranges),
+};
 
-#if IS_ENABLED(CONFIG_USB_NOTIFIER)
-static void eusb2_repeater_update_seq(struct eusb2_repeater *er, u8 *seq, u8 cnt)
+static const struct regmap_range eusb2_ti_volatile_ranges[] = {
+	regmap_reg_range(INT_STATUS_1, INT_STATUS_2),
+	regmap_reg_range(BC_STATUS_1, BC_STATUS_1),
+};
+
+static const struct regmap_access_table eusb2_ti_volatile_table = {
+	.yes_ranges = eusb2_ti_volatile_ranges,
+	.n_yes_ranges = ARRAY_SIZE(eusb2_ti_volatile_ranges),
+};
+
+/* interrupt status is cleared on read, keep it out of debugfs dumps */
+static const struct regmap_range eusb2_ti_precious_ranges[] = {
+	regmap_reg_range(INT_STATUS_1, INT_STATUS_2),
+};
+
+static const struct regmap_access_table eusb2_ti_precious_table = {
+	.yes_ranges = eusb2_ti_precious_ranges,
+	.n_yes_ranges = ARRAY_SIZE(eusb2_ti_precious_ranges),
+};
+
+static const struct regmap_range eusb2_nxp_rd_ranges[] = {
+	regmap_reg_range(RESET_CONTROL, CHIP_ID_2),
+};
+
+static const struct regmap_access_table eusb2_nxp_rd_table = {
+	.yes_ranges = eusb2_nxp_rd_ranges,
+	.n_yes_ranges = ARRAY_SIZE(eusb2_nxp_rd_ranges),
+};
+
+static const struct regmap_range eusb2_nxp_wr_ranges[] = {
+	regmap_reg_range(RESET_CONTROL, USB2_HS_DISCONNECT_THRESHOLD),
+	regmap_reg_range(RAP_SIGNATURE, RAP_SIGNATURE),
+};
+
+static const struct regmap_access_table eusb2_nxp_wr_table = {
+	.yes_ranges = eusb2_nxp_wr_ranges,
+	.n_yes_ranges = ARRAY_SIZE(eusb2_nxp_wr_ranges),
+};
+
+/* sorted by address, the debugfs dump walks them in this order */
+static const struct regmap_range eusb2_ti_rd_ranges[] = {
+	regmap_reg_range(GPIO0_CONFIG, GPIO0_CONFIG),
+	regmap_reg_range(GPIO1_CONFIG, GPIO1_CONFIG),
+	regmap_reg_range(UART_PORT1, EXTRA_PORT1),
+	regmap_reg_range(INT_STATUS_1, BC_STATUS_1),
+};
+
+static const struct regmap_access_table eusb2_ti_rd_table = {
+	.yes_ranges = eusb2_ti_rd_ranges,
+	.n_yes_ranges = ARRAY_SIZE(eusb2_ti_rd_ranges),
+};
+
+static const struct regmap_range eusb2_ti_wr_ranges[] = {
+	regmap_reg_range(GPIO0_CONFIG, GPIO0_CONFIG),
+	regmap_reg_range(GPIO1_CONFIG, GPIO1_CONFIG),
+	regmap_reg_range(UART_PORT1, EXTRA_PORT1),
+	regmap_reg_range(GLOBAL_CONFIG, INT_ENABLE_2),
+	regmap_reg_range(BC_CONTROL, BC_CONTROL),
+};
+
+static const struct regmap_access_table eusb2_ti_wr_table = {
+	.yes_ranges = eusb2_ti_wr_ranges,
+	.n_yes_ranges = ARRAY_SIZE(eusb2_ti_wr_ranges),
+};
+
+static bool eusb2_repeater_reg_precious(struct eusb2_repeater *er, int reg)
 {
-	int i, j, ret;
+	return er->chip->precious_table &&
+		regmap_check_range_table(er->regmap, reg, er->chip->precious_table);
+}
 
-	dev_dbg(er->ur.dev, "%s %s mode param override seq count:%d\n",
-		er->chip->repeater_type ? "NXP":"TI", er->ur.is_host ? "HOST":"CLIENT", cnt);
-	cnt /= 4;
-	for (i = 0; i < cnt; i = i+2) {
-		for (j = 0; j < 3; j++) {
-			ret = regmap_write(er->regmap, seq[i * 4 + 7], seq[i * 4 + 3]);
-			if (ret < 0)
-				dev_err(er->dev, "failed to write 0x%02x to reg: 0x%02x ret=%d\n",
-					seq[i * 4 + 3], seq[i * 4 + 7], ret);
-			else {
-				dev_dbg(er->ur.dev, "write 0x%02x to 0x%02x\n", seq[i * 4 + 3], seq[i * 4 + 7]);
-				break;
-			}
-		}
-	}
+static bool eusb2_repeater_reg_readable(struct eusb2_repeater *er, int reg)
+{
+	return regmap_check_range_table(er->regmap, reg, er->chip->rd_table);
 }
-#else
-static int eusb2_i2c_read_reg(struct eusb2_repeater *er, u8 reg, u8 *val)
+
+/* override sequences and tuning are checked against this up front */
+static bool eusb2_repeater_reg_writeable(struct eusb2_repeater *er, int reg)
 {
-	int ret;
-	unsigned int reg_val;
+	return regmap_check_range_table(er->regmap, reg, er->chip->wr_table);
+}
 
-	ret = regmap_read(er->regmap, reg, &reg_val);
-	if (ret < 0) {
-		dev_err(er->dev, "Failed to read reg:0x%02x ret=%d\n", reg, ret);
-		return ret;
-	}
+/* the chip answers on the bus, register accesses are not just cached */
+static bool eusb2_repeater_accessible(struct eusb2_repeater *er)
+{
+	return er->power_enabled && !er->in_retention &&
+		er->reset_state == EUSB2_RESET_READY;
+}
 
-	*val = reg_val;
-	dev_dbg(er->dev, "read reg:0x%02x val:0x%02x\n", reg, *val);
+static const char * const eusb2_xfer_op_names[] = {
+	[EUSB2_XFER_READ]		= "read",
+	[EUSB2_XFER_WRITE]		= "write",
+	[EUSB2_XFER_BULK_READ]		= "bulk_read",
+	[EUSB2_XFER_BULK_WRITE]		= "bulk_write",
+	[EUSB2_XFER_MULTI_WRITE]	= "multi_write",
+	[EUSB2_XFER_SYNC]		= "sync",
+};
 
-	return 0;
+/*
+ * Record a register transaction in the per-device ring and emit it as a
+ * tracepoint. Writers only claim a slot with an atomic increment, so the
+ * log is usable from any context and never waits on a console.
+ */
+static void eusb2_repeater_log_xfer(struct eusb2_repeater *er,
+		enum eusb2_xfer_op op, u8 reg, u16 val, int ret, u8 retry)
+{
+	unsigned int i = atomic_inc_return(&er->xfer_head) - 1;
+	struct eusb2_xfer_rec *rec = &er->xfer_log[i % EUSB2_XFER_LOG_CNT];
+
+	rec->ts = local_clock();
+	rec->op = op;
+	rec->reg = reg;
+	rec->val = val;
+	rec->ret = ret;
+	rec->retry = retry;
+
+	trace_eusb2_repeater_xfer(dev_name(er->dev), eusb2_xfer_op_names[op],
+			reg, val, ret, retry);
+	usb_repeater_stat_xfer(&er->ur, ret, retry);
 }
 
-static int eusb2_i2c_write_reg(struct eusb2_repeater *er, u8 reg, u8 mask, u8 val)
-{
-	int ret;
-	u8 reg_val;
+#if IS_ENABLED(CONFIG_USB_NOTIFIER)
+/* override sequences are <val reg> u32 cells, values replace the register */
+#define EUSB2_SEQ_MASK			0x00
+#else
+/* override sequences are <val reg> bytes, values are OR-ed into the register */
+#define EUSB2_SEQ_MASK			0xFF
+#endif
 
-	ret = eusb2_i2c_read_reg(er, reg, &reg_val);
-	if (ret)
-		return ret;
+/*
+ * Compile a register image into a table with one (reg, mask, val) entry
+ * per register, sorted by address. Consecutive registers are merged into
+ * auto-increment bursts. The remaining ones are handed to regmap in one
+ * multi register write, which on i2c still costs a transfer per register.
+ */
+static int eusb2_repeater_build_seq(struct eusb2_repeater *er,
+		const struct eusb2_seq_entry *image, const unsigned long *used,
+		struct eusb2_seq *cs)
+{
+	struct eusb2_seq_burst *b;
+	int i, n, len, reg;
+
+	cs->burst_cnt = 0;
+	cs->single_cnt = 0;
+	cs->rmw = false;
+	cs->cnt = bitmap_weight(used, EUSB2_REG_CNT);
+	if (!cs->cnt)
+		return 0;
 
-	val |= (reg_val & mask);
-	ret = regmap_write(er->regmap, reg, val);
-	if (ret < 0) {
-		dev_err(er->dev, "failed to write 0x%02x to reg: 0x%02x ret=%d\n", val, reg, ret);
-		return ret;
+	cs->entry = devm_kcalloc(er->dev, cs->cnt, sizeof(*cs->entry), GFP_KERNEL);
+	cs->buf = devm_kcalloc(er->dev, cs->cnt, sizeof(*cs->buf), GFP_KERNEL);
+	cs->burst = devm_kcalloc(er->dev, cs->cnt, sizeof(*cs->burst), GFP_KERNEL);
+	cs->single = devm_kcalloc(er->dev, cs->cnt, sizeof(*cs->single), GFP_KERNEL);
+	if (!cs->entry || !cs->buf || !cs->burst || !cs->single)
+		return -ENOMEM;
+
+	n = 0;
+	for_each_set_bit(reg, used, EUSB2_REG_CNT) {
+		cs->entry[n] = image[reg];
+		cs->buf[n] = image[reg].val;
+		cs->rmw |= !!image[reg].mask;
+		n++;
 	}
 
-	dev_dbg(er->dev, "write reg:0x%02x val:0x%02x\n", reg, val);
+	for (i = 0; i < cs->cnt; i += len) {
+		reg = cs->entry[i].reg;
+		for (len = 1; i + len < cs->cnt && len < EUSB2_SEQ_MAX_BURST; len++)
+			if (cs->entry[i + len].reg != reg + len)
+				break;
+
+		if (len == 1) {
+			cs->single[cs->single_cnt].reg = reg;
+			cs->single[cs->single_cnt].def = cs->buf[i];
+			cs->single_cnt++;
+			continue;
+		}
+
+		b = &cs->burst[cs->burst_cnt++];
+		b->reg = reg;
+		b->len = len;
+		b->idx = i;
+	}
 
 	return 0;
 }
 
-static void eusb2_repeater_update_seq(struct eusb2_repeater *er, u8 *seq, u8 cnt)
+/* undo eusb2_repeater_build_seq(), also after it failed half way */
+static void eusb2_repeater_free_seq(struct eusb2_repeater *er, struct eusb2_seq *cs)
 {
-	int i;
-	u8 mask = 0xFF;
+	if (cs->entry)
+		devm_kfree(er->dev, cs->entry);
+	if (cs->buf)
+		devm_kfree(er->dev, cs->buf);
+	if (cs->burst)
+		devm_kfree(er->dev, cs->burst);
+	if (cs->single)
+		devm_kfree(er->dev, cs->single);
+	memset(cs, 0, sizeof(*cs));
+}
 
-	dev_dbg(er->ur.dev, "param override seq count:%d\n", cnt);
-	for (i = 0; i < cnt; i = i+2) {
-		dev_dbg(er->ur.dev, "write 0x%02x to 0x%02x\n", seq[i], seq[i+1]);
-		eusb2_i2c_write_reg(er, seq[i+1], mask, seq[i]);
-	}
+static bool eusb2_repeater_has_image(struct eusb2_repeater *er)
+{
+	return er->chip->init_image_cnt;
 }
-#endif
 
-#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
-static void eusb2_repeater_tune_buf_init(void)
+/* chip default registers */
+static void eusb2_repeater_seed_image(struct eusb2_repeater *er,
+		struct eusb2_seq_entry *image, unsigned long *used)
 {
-	int i;
-	for (i = 0; i < TUNE_BUF_COUNT; i++) {
-		ter->tune_buf[i][0] = ter->tune_buf[i][1] = 0;
+	int i, reg;
+
+	for (i = 0; i < er->chip->init_image_cnt; i++) {
+		reg = er->chip->init_image[i].reg;
+		image[reg].reg = reg;
+		image[reg].mask = 0;
+		image[reg].val = er->chip->init_image[i].def;
+		__set_bit(reg, used);
 	}
 }
 
-static void eusb2_repeater_tune_set(void)
+/*
+ * Fold the chip's default init image and a DT override sequence (last
+ * write wins) and compile them. Without the DT property, only a sequence
+ * which is always used (@defaults) gets the chip image.
+ */
+static int eusb2_repeater_parse_seq(struct eusb2_repeater *er,
+		const char *prop, struct eusb2_seq *cs, bool defaults)
 {
-	int i, j, ret;
-	unsigned int reg_val;
+	DECLARE_BITMAP(used, EUSB2_REG_CNT);
+	struct eusb2_seq_entry *image = NULL;
+#if IS_ENABLED(CONFIG_USB_NOTIFIER)
+	u32 *raw = NULL;
+#else
+	u8 *raw = NULL;
+#endif
+	int i, reg, num_elem, ret = 0;
+
+	num_elem = of_property_count_elems_of_size(er->dev->of_node, prop,
+			sizeof(*raw));
+	if (num_elem <= 0) {
+		if (!defaults || !eusb2_repeater_has_image(er))
+			return 0;
+		num_elem = 0;
+	}
 
-	mutex_lock(&ter->er_tune_lock);
-	for (i = 0; i < ter->tune_buf_cnt; i++) {
-		for (j = 0; j < 3; j++) {
-			if (!ter->ur.is_host && ter->chip->repeater_type == NXP_REPEATER &&
-				ter->tune_buf[i][0] == 0x2 && ter->tune_buf[i][1] == 0x03) {
-				pr_info("%s(): skip host test mode setting in USB client mode\n");
-				break;
-			}
-			ret = regmap_write(ter->regmap, ter->tune_buf[i][0], ter->tune_buf[i][1]);
-			if (ret < 0)
-				dev_err(ter->dev, "failed to write 0x%02x to reg: 0x%02x ret=%d\n",
-					ter->tune_buf[i][1], ter->tune_buf[i][0], ret);
-			else
-				break;
+	if (num_elem % 2) {
+		dev_err(er->dev, "invalid %s len\n", prop);
+		return -EINVAL;
+	}
+
+	if (num_elem) {
+		raw = kcalloc(num_elem, sizeof(*raw), GFP_KERNEL);
+		if (!raw)
+			return -ENOMEM;
+
+#if IS_ENABLED(CONFIG_USB_NOTIFIER)
+		ret = of_property_read_u32_array(er->dev->of_node, prop, raw, num_elem);
+#else
+		ret = of_property_read_u8_array(er->dev->of_node, prop, raw, num_elem);
+#endif
+		if (ret) {
+			dev_err(er->dev, "%s read failed %d\n", prop, ret);
+			goto out;
 		}
-		usleep_range(1, 10);
-		for (j = 0; j < 3; j++) {
-			ret = regmap_read(ter->regmap, ter->tune_buf[i][0], &reg_val);
-			if (ret < 0)
-				dev_err(ter->dev, "Failed to read reg:0x%02x ret=%d\n", ter->tune_buf[i][0], ret);
-			else
-				break;
+	}
+
+	image = kmalloc_array(EUSB2_REG_CNT, sizeof(*image), GFP_KERNEL);
+	if (!image) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* chip defaults first, DT entries override them */
+	bitmap_zero(used, EUSB2_REG_CNT);
+	eusb2_repeater_seed_image(er, image, used);
+
+	for (i = 0; i < num_elem; i += 2) {
+		if (raw[i] > U8_MAX || raw[i + 1] > U8_MAX) {
+			dev_err(er->dev, "%s: invalid entry 0x%x 0x%x\n", prop,
+					raw[i], raw[i + 1]);
+			ret = -EINVAL;
+			goto out;
 		}
-		pr_info("%s(): [%d] 0x%x 0x%x (%d/%d)\n", __func__, i, ter->tune_buf[i][0],
-			reg_val, ter->tune_buf_cnt, TUNE_BUF_COUNT);
-		usleep_range(1, 2);
+
+		reg = raw[i + 1];
+		if (!eusb2_repeater_reg_writeable(er, reg)) {
+			dev_err(er->dev, "%s: reg 0x%02x is not writeable\n", prop, reg);
+			ret = -EINVAL;
+			goto out;
+		}
+		image[reg].reg = reg;
+		image[reg].mask = EUSB2_SEQ_MASK;
+		image[reg].val = raw[i];
+		__set_bit(reg, used);
 	}
-	mutex_unlock(&ter->er_tune_lock);
+
+	ret = eusb2_repeater_build_seq(er, image, used, cs);
+	if (!ret)
+		dev_dbg(er->dev, "%s: %d regs in %d bursts and %d singles\n", prop,
+				cs->cnt, cs->burst_cnt, cs->single_cnt);
+out:
+	kfree(image);
+	kfree(raw);
+	return ret;
 }
 
-static ssize_t eusb2_repeater_tune_show(struct device *dev,
-		struct device_attribute *attr, char *buf)
+#if IS_ENABLED(CONFIG_USB_NOTIFIER)
+/*
+ * Entries of @to which have to be written when the repeater is currently
+ * programmed with @from: registers @from does not touch or sets to another
+ * value. Registers only present in @from are not restored by a full write
+ * of @to either, so they are left alone.
+ */
+static int eusb2_repeater_diff_seq(struct eusb2_repeater *er,
+		const struct eusb2_seq *from, const struct eusb2_seq *to,
+		struct eusb2_seq *delta)
 {
-	char str[(TUNE_BUF_SIZE * TUNE_BUF_COUNT) + 35] = {0, };
-	int i, ret;
-	unsigned int reg_val;
+	DECLARE_BITMAP(used, EUSB2_REG_CNT);
+	struct eusb2_seq_entry *image;
+	const struct eusb2_seq_entry *e;
+	int i, j, ret;
 
-	if (!ter) {
-		pr_err("eusb2 repeater is NULL\n");
-		return -ENODEV;
+	image = kmalloc_array(EUSB2_REG_CNT, sizeof(*image), GFP_KERNEL);
+	if (!image)
+		return -ENOMEM;
+
+	bitmap_zero(used, EUSB2_REG_CNT);
+	for (i = 0, j = 0; i < to->cnt; i++) {
+		e = &to->entry[i];
+		while (j < from->cnt && from->entry[j].reg < e->reg)
+			j++;
+
+		if (!e->mask && j < from->cnt && from->entry[j].reg == e->reg &&
+				!from->entry[j].mask && from->entry[j].val == e->val)
+			continue;
+
+		image[e->reg] = *e;
+		__set_bit(e->reg, used);
 	}
-	mutex_lock(&ter->er_tune_lock);
-	sprintf(str, "\n Address Value - %s\n", ter->chip->repeater_type ? "NXP":"TI");
-	if (ter->chip->repeater_type == NXP_REPEATER) {
-		for (i = 0; i < TUNE_MAX_NXP; i++) {
-			ret = regmap_read(ter->regmap, tune_map_nxp[i], &reg_val);
-			if (ret < 0) {
-				dev_err(ter->dev, "Failed to read reg:0x%02x ret=%d\n", tune_map_nxp[i], ret);
-				mutex_unlock(&ter->er_tune_lock);
-				return sprintf(buf, "Failed to read reg\n");
-			}
-			sprintf(str, "%s  0x%2x   0x%2x\n", str, tune_map_nxp[i], reg_val);
-		}
-	} else {
-		for (i = 0; i < TUNE_MAX_TI; i++) {
-			ret = regmap_read(ter->regmap, tune_map_ti[i], &reg_val);
-			if (ret < 0) {
-				dev_err(ter->dev, "Failed to read reg:0x%02x ret=%d\n", tune_map_ti[i], ret);
-				mutex_unlock(&ter->er_tune_lock);
-				return sprintf(buf, "Failed to read reg\n");
-			}
-			sprintf(str, "%s  0x%2x   0x%2x\n", str, tune_map_ti[i], reg_val);
-		}
+
+	ret = eusb2_repeater_build_seq(er, image, used, delta);
+	kfree(image);
+	return ret;
+}
+#endif
+
+/*
+ * Calibration blob: a header, then per section an id, an entry count and
+ * (reg, mask, val) entries. It holds the effective register image, DT
+ * override plus tuning, and is read back from calib_blob once the board
+ * is tuned. dt_crc ties it to the DT overrides it was built from, a blob
+ * saved with other overrides is ignored. Bump the version whenever the
+ * layout or the meaning of an image changes.
+ */
+#define EUSB2_CALIB_MAGIC		0x43523245	/* "E2RC" */
+#define EUSB2_CALIB_VERSION		1
+
+enum eusb2_calib_section_id {
+	EUSB2_CALIB_DEVICE,
+	EUSB2_CALIB_HOST,
+	EUSB2_CALIB_TUNE,
+	EUSB2_CALIB_SECTION_CNT,
+};
+
+struct eusb2_calib_hdr {
+	__le32	magic;
+	__le16	version;
+	__le16	len;
+	char	chip[8];
+	__le32	dt_crc;
+	__le32	crc;
+} __packed;
+
+struct eusb2_calib_section {
+	u8	id;
+	__le16	cnt;
+	struct eusb2_seq_entry entry[];
+} __packed;
+
+#define EUSB2_CALIB_MAX_LEN		(sizeof(struct eusb2_calib_hdr) + \
+		EUSB2_CALIB_SECTION_CNT * (sizeof(struct eusb2_calib_section) + \
+		EUSB2_REG_CNT * sizeof(struct eusb2_seq_entry)))
+
+static const char * const eusb2_calib_dt_props[] = {
+	"qcom,param-override-seq",
+	"qcom,param-host-override-seq",
+};
+
+static u32 eusb2_calib_dt_crc(struct eusb2_repeater *er)
+{
+	const void *val;
+	u32 crc = 0;
+	int i, len;
+
+	for (i = 0; i < ARRAY_SIZE(eusb2_calib_dt_props); i++) {
+		val = of_get_property(er->dev->of_node, eusb2_calib_dt_props[i], &len);
+		if (val)
+			crc = crc32_le(crc, val, len);
 	}
-	mutex_unlock(&ter->er_tune_lock);
 
-	return sprintf(buf, "%s\n", str);
+	return crc;
 }
 
-static ssize_t eusb2_repeater_tune_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t size)
+static int eusb2_calib_apply_section(struct eusb2_repeater *er,
+		const struct eusb2_calib_section *sec, int cnt)
 {
-	u8 reg, val;
+	DECLARE_BITMAP(used, EUSB2_REG_CNT);
+	struct eusb2_seq_entry *image;
+	struct eusb2_seq *cs = NULL;
 	int i, ret;
-	unsigned int reg_val;
 
-	pr_info("%s buf=%s\n", __func__, buf);
-	if (!ter) {
-		pr_err("eusb2 repeater is NULL\n");
-		return -ENODEV;
+	switch (sec->id) {
+	case EUSB2_CALIB_DEVICE:
+		cs = &er->override_seq;
+		break;
+#if IS_ENABLED(CONFIG_USB_NOTIFIER)
+	case EUSB2_CALIB_HOST:
+		cs = &er->host_override_seq;
+		break;
+#endif
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	case EUSB2_CALIB_TUNE:
+		er->calib_tune = devm_kmemdup(er->dev, sec->entry,
+				cnt * sizeof(*sec->entry), GFP_KERNEL);
+		if (!er->calib_tune)
+			return -ENOMEM;
+		er->calib_tune_cnt = cnt;
+		return 0;
+#endif
+	default:
+		/* saved by a kernel with other features enabled */
+		return 0;
 	}
-	sscanf(buf, "%x %x", &reg, &val);
-	mutex_lock(&ter->er_tune_lock);
 
-	for (i = 0; i < ter->tune_buf_cnt; i++) {
-		if (ter->tune_buf[i][0] == reg) {
-			ret = regmap_write(ter->regmap, reg, val);
-			if (ret < 0) {
-				dev_err(ter->dev, "failed to write 0x%02x to reg: 0x%02x ret=%d\n", val, reg, ret);
-				mutex_unlock(&ter->er_tune_lock);
-				return ret;
-			}
-			ter->tune_buf[i][1] = val;
-			usleep_range(1, 2);
-			ret = regmap_read(ter->regmap, reg, &reg_val);
-			if (ret < 0) {
-				dev_err(ter->dev, "Failed to read reg:0x%02x ret=%d\n", reg, ret);
-				mutex_unlock(&ter->er_tune_lock);
-				return ret;
-			}
-			pr_info("%s(): [%d] 0x%x 0x%x (%d/%d)\n", __func__, i, reg,
-				reg_val, ter->tune_buf_cnt, TUNE_BUF_COUNT);
-			mutex_unlock(&ter->er_tune_lock);
-			return size;
-		}
-	}
-	if (ter->tune_buf_cnt < TUNE_BUF_COUNT) {
-		ret = regmap_write(ter->regmap, reg, val);
-		if (ret < 0) {
-			dev_err(ter->dev, "failed to write 0x%02x to reg: 0x%02x ret=%d\n", val, reg, ret);
-			mutex_unlock(&ter->er_tune_lock);
-			return ret;
-		}
-		ter->tune_buf[i][0] = reg;
-		ter->tune_buf[i][1] = val;
-		usleep_range(1, 2);
-		ret = regmap_read(ter->regmap, reg, &reg_val);
-		if (ret < 0) {
-			dev_err(ter->dev, "Failed to read reg:0x%02x ret=%d\n", reg, ret);
-			mutex_unlock(&ter->er_tune_lock);
-			return ret;
-		}
-		pr_info("%s(): [%d] 0x%x 0x%x (%d/%d)\n", __func__, i, reg,
-			reg_val, ter->tune_buf_cnt, TUNE_BUF_COUNT);
-		ter->tune_buf_cnt++;
-	} else
-		pr_info("%s(): tuning count is full\n", __func__);
+	image = kmalloc_array(EUSB2_REG_CNT, sizeof(*image), GFP_KERNEL);
+	if (!image)
+		return -ENOMEM;
 
-	mutex_unlock(&ter->er_tune_lock);
+	bitmap_zero(used, EUSB2_REG_CNT);
+	for (i = 0; i < cnt; i++) {
+		image[sec->entry[i].reg] = sec->entry[i];
+		__set_bit(sec->entry[i].reg, used);
+	}
 
-	return size;
+	ret = eusb2_repeater_build_seq(er, image, used, cs);
+	kfree(image);
+	return ret;
 }
 
-static DEVICE_ATTR_RW(eusb2_repeater_tune);
-					       
-static struct attribute *eusb2_repeater_attributes[] = {
-	&dev_attr_eusb2_repeater_tune.attr,
-	NULL
-};
+/* walk the sections twice, nothing is applied unless all of them are sane */
+static int eusb2_calib_parse(struct eusb2_repeater *er, const u8 *p, size_t len)
+{
+	DECLARE_BITMAP(used, EUSB2_REG_CNT);
+	const struct eusb2_calib_section *sec;
+	unsigned long seen = 0;
+	const u8 *end = p + len, *q;
+	int i, cnt = 0, ret, pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (q = p; q < end; q += sizeof(*sec) + cnt * sizeof(*sec->entry)) {
+			sec = (const void *)q;
+			if (end - q < sizeof(*sec))
+				return -EINVAL;
+			cnt = le16_to_cpu(sec->cnt);
+			if (end - q - sizeof(*sec) < cnt * sizeof(*sec->entry))
+				return -EINVAL;
+
+			if (pass) {
+				ret = eusb2_calib_apply_section(er, sec, cnt);
+				if (ret)
+					return ret;
+				continue;
+			}
 
-const struct attribute_group eusb2_repeater_sysfs_group = {
-	.attrs = eusb2_repeater_attributes,
-};
-#endif
+			if (sec->id >= EUSB2_CALIB_SECTION_CNT || __test_and_set_bit(sec->id, &seen))
+				return -EINVAL;
+			bitmap_zero(used, EUSB2_REG_CNT);
+			for (i = 0; i < cnt; i++)
+				if (__test_and_set_bit(sec->entry[i].reg, used) ||
+						!eusb2_repeater_reg_writeable(er, sec->entry[i].reg))
+					return -EINVAL;
+		}
+	}
 
-static int eusb2_repeater_power(struct eusb2_repeater *er, bool on)
+	return 0;
+}
+
+/*
+ * Looked up during probe, so a built-in driver needs the blob in the
+ * initramfs or vendor firmware path. Any mismatch falls back to DT.
+ */
+static int eusb2_repeater_calib_load(struct eusb2_repeater *er)
 {
-	int ret = 0;
+	const struct eusb2_calib_hdr *hdr;
+	const struct firmware *fw;
+	const char *name;
+	int ret;
 
-	dev_dbg(er->ur.dev, "%s turn %s regulators. power_enabled:%d\n",
-			__func__, on ? "on" : "off", er->power_enabled);
+	if (of_property_read_string(er->dev->of_node, "qcom,calib-firmware", &name))
+		return -ENOENT;
 
-	if (er->power_enabled == on) {
-		dev_dbg(er->ur.dev, "regulators are already ON.\n");
-		return 0;
+	ret = firmware_request_nowarn(&fw, name, er->dev);
+	if (ret) {
+		dev_dbg(er->dev, "no calibration blob %s ret=%d\n", name, ret);
+		return ret;
 	}
 
-	if (!on)
-		goto disable_vdd3;
+	hdr = (const void *)fw->data;
+	ret = -EINVAL;
+	if (fw->size < sizeof(*hdr) || le32_to_cpu(hdr->magic) != EUSB2_CALIB_MAGIC ||
+			fw->size != sizeof(*hdr) + le16_to_cpu(hdr->len)) {
+		dev_warn(er->dev, "%s: not a calibration blob\n", name);
+		goto out;
+	}
+	if (le16_to_cpu(hdr->version) != EUSB2_CALIB_VERSION ||
+			strncmp(hdr->chip, er->chip->name, sizeof(hdr->chip))) {
+		dev_warn(er->dev, "%s: version %u for %.8s, expected %u for %s\n", name,
+				le16_to_cpu(hdr->version), hdr->chip,
+				EUSB2_CALIB_VERSION, er->chip->name);
+		goto out;
+	}
+	if (le32_to_cpu(hdr->crc) != crc32_le(0, fw->data + sizeof(*hdr),
+			fw->size - sizeof(*hdr))) {
+		dev_warn(er->dev, "%s: bad crc\n", name);
+		goto out;
+	}
+	if (le32_to_cpu(hdr->dt_crc) != eusb2_calib_dt_crc(er)) {
+		dev_warn(er->dev, "%s: saved with other DT overrides, ignored\n", name);
+		goto out;
+	}
 
-	ret = regulator_set_load(er->vdd18, EUSB2_1P8_HPM_LOAD);
-	if (ret < 0) {
-		dev_err(er->ur.dev, "Unable to set HPM of vdd12:%d\n", ret);
-		goto err_vdd18;
+	ret = eusb2_calib_parse(er, fw->data + sizeof(*hdr), fw->size - sizeof(*hdr));
+	if (ret) {
+		dev_warn(er->dev, "%s: malformed sections ret=%d\n", name, ret);
+		goto out;
 	}
 
-	ret = regulator_set_voltage(er->vdd18, EUSB2_1P8_VOL_MIN,
-						EUSB2_1P8_VOL_MAX);
-	if (ret) {
-		dev_err(er->ur.dev,
-				"Unable to set voltage for vdd18:%d\n", ret);
-		goto put_vdd18_lpm;
+	er->calib_loaded = true;
+	dev_info(er->dev, "calibration loaded from %s\n", name);
+out:
+	release_firmware(fw);
+	if (ret) {
+		/* sections applied before the failing one, DT takes over */
+		eusb2_repeater_free_seq(er, &er->override_seq);
+#if IS_ENABLED(CONFIG_USB_NOTIFIER)
+		eusb2_repeater_free_seq(er, &er->host_override_seq);
+#endif
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+		if (er->calib_tune)
+			devm_kfree(er->dev, er->calib_tune);
+		er->calib_tune = NULL;
+		er->calib_tune_cnt = 0;
+#endif
+	}
+	return ret;
+}
+
+static u8 *eusb2_calib_put(u8 *p, u8 id, const struct eusb2_seq_entry *entry, int cnt)
+{
+	struct eusb2_calib_section *sec = (void *)p;
+
+	sec->id = id;
+	sec->cnt = cpu_to_le16(cnt);
+	memcpy(sec->entry, entry, cnt * sizeof(*entry));
+
+	return p + sizeof(*sec) + cnt * sizeof(*entry);
+}
+
+/* @blob is EUSB2_CALIB_MAX_LEN bytes long */
+static size_t eusb2_calib_build(struct eusb2_repeater *er, u8 *blob)
+{
+	struct eusb2_calib_hdr *hdr = (void *)blob;
+	u8 *p = blob + sizeof(*hdr);
+	size_t len;
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	struct eusb2_calib_section *sec;
+	const struct eusb2_tune_table *t;
+	int reg, cnt = 0;
+#endif
+
+	if (er->override_seq.cnt)
+		p = eusb2_calib_put(p, EUSB2_CALIB_DEVICE, er->override_seq.entry,
+				er->override_seq.cnt);
+#if IS_ENABLED(CONFIG_USB_NOTIFIER)
+	if (er->host_override_seq.cnt)
+		p = eusb2_calib_put(p, EUSB2_CALIB_HOST, er->host_override_seq.entry,
+				er->host_override_seq.cnt);
+#endif
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	/* the tuning table is not kept as entries, build them in place */
+	sec = (void *)p;
+	rcu_read_lock();
+	t = rcu_dereference(er->tune);
+	if (t) {
+		for_each_set_bit(reg, t->used, EUSB2_REG_CNT) {
+			sec->entry[cnt].reg = reg;
+			sec->entry[cnt].mask = 0;
+			sec->entry[cnt++].val = t->val[reg];
+		}
+	}
+	rcu_read_unlock();
+	if (cnt) {
+		sec->id = EUSB2_CALIB_TUNE;
+		sec->cnt = cpu_to_le16(cnt);
+		p += sizeof(*sec) + cnt * sizeof(*sec->entry);
+	}
+#endif
+
+	len = p - blob - sizeof(*hdr);
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = cpu_to_le32(EUSB2_CALIB_MAGIC);
+	hdr->version = cpu_to_le16(EUSB2_CALIB_VERSION);
+	hdr->len = cpu_to_le16(len);
+	strscpy(hdr->chip, er->chip->name, sizeof(hdr->chip));
+	hdr->dt_crc = cpu_to_le32(eusb2_calib_dt_crc(er));
+	hdr->crc = cpu_to_le32(crc32_le(0, blob + sizeof(*hdr), len));
+
+	return sizeof(*hdr) + len;
+}
+
+/* merge the current (cached) register contents into masked entries */
+static void eusb2_repeater_seq_refresh(struct eusb2_repeater *er, struct eusb2_seq *cs)
+{
+	struct eusb2_seq_entry *e;
+	unsigned int reg_val = 0;
+	int i, j, ret;
+
+	for (i = 0, j = 0; i < cs->cnt; i++) {
+		e = &cs->entry[i];
+		ret = regmap_read(er->regmap, e->reg, &reg_val);
+		eusb2_repeater_log_xfer(er, EUSB2_XFER_READ, e->reg, reg_val, ret, 0);
+		if (ret < 0) {
+			dev_err(er->dev, "Failed to read reg:0x%02x\n", e->reg);
+			reg_val = 0;
+		}
+
+		cs->buf[i] = e->val | (reg_val & e->mask);
+		if (j < cs->single_cnt && cs->single[j].reg == e->reg)
+			cs->single[j++].def = cs->buf[i];
+	}
+}
+
+static int eusb2_repeater_update_seq(struct eusb2_repeater *er, struct eusb2_seq *cs)
+{
+	struct eusb2_seq_burst *b;
+	int i, j, ret = 0;
+
+	dev_dbg(er->ur.dev, "%s %s mode param override seq count:%d\n",
+		er->chip->name, er->ur.is_host ? "HOST":"CLIENT", cs->cnt);
+
+	if (cs->rmw)
+		eusb2_repeater_seq_refresh(er, cs);
+
+	for (i = 0; i < cs->burst_cnt; i++) {
+		b = &cs->burst[i];
+		for (j = 0; j < 3; j++) {
+			ret = regmap_bulk_write(er->regmap, b->reg, &cs->buf[b->idx], b->len);
+			eusb2_repeater_log_xfer(er, EUSB2_XFER_BULK_WRITE, b->reg, b->len, ret, j);
+			if (!ret)
+				break;
+			dev_err(er->dev, "failed to write %d regs from reg: 0x%02x ret=%d\n",
+				b->len, b->reg, ret);
+		}
+		if (ret)
+			return ret;
+	}
+
+	if (!cs->single_cnt)
+		return 0;
+
+	for (j = 0; j < 3; j++) {
+		ret = regmap_multi_reg_write(er->regmap, cs->single, cs->single_cnt);
+		eusb2_repeater_log_xfer(er, EUSB2_XFER_MULTI_WRITE, cs->single[0].reg,
+				cs->single_cnt, ret, j);
+		if (!ret)
+			break;
+		dev_err(er->dev, "failed to write %d regs ret=%d\n", cs->single_cnt, ret);
+	}
+
+	return ret;
+}
+
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+static struct eusb2_tune_table *eusb2_repeater_tune_table(struct eusb2_repeater *er)
+{
+	return rcu_dereference_protected(er->tune, lockdep_is_held(&er->hw_lock));
+}
+
+/*
+ * Publish a copy of the tuning table with @used set to @val. Readers
+ * still looking at the old table see it until a grace period passed.
+ */
+static struct eusb2_tune_table *eusb2_repeater_tune_update(struct eusb2_repeater *er,
+		const unsigned long *used, const u8 *val)
+{
+	struct eusb2_tune_table *old = eusb2_repeater_tune_table(er);
+	struct eusb2_tune_table *t;
+	int reg;
+
+	t = kmemdup(old, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return NULL;
+
+	for_each_set_bit(reg, used, EUSB2_REG_CNT)
+		t->val[reg] = val[reg];
+	bitmap_or(t->used, t->used, used, EUSB2_REG_CNT);
+
+	rcu_assign_pointer(er->tune, t);
+	kfree_rcu(old, rcu);
+
+	return t;
+}
+
+static bool eusb2_repeater_tune_skip(struct eusb2_repeater *er,
+		const struct eusb2_tune_table *t, int reg)
+{
+	return er->chip->ops && er->chip->ops->skip_write &&
+		er->chip->ops->skip_write(er, reg, t->val[reg]);
+}
+
+/* write the tuning registers in @used, one burst per run of registers */
+static int eusb2_repeater_tune_write(struct eusb2_repeater *er,
+		const struct eusb2_tune_table *t, const unsigned long *used)
+{
+	int reg, len, j, ret = 0;
+
+	for_each_set_bit(reg, used, EUSB2_REG_CNT) {
+		if (eusb2_repeater_tune_skip(er, t, reg)) {
+			dev_dbg(er->dev, "skip host test mode setting in USB client mode\n");
+			continue;
+		}
+
+		for (len = 1; reg + len < EUSB2_REG_CNT && len < EUSB2_SEQ_MAX_BURST; len++)
+			if (!test_bit(reg + len, used) ||
+					eusb2_repeater_tune_skip(er, t, reg + len))
+				break;
+
+		for (j = 0; j < 3; j++) {
+			ret = regmap_bulk_write(er->regmap, reg, &t->val[reg], len);
+			eusb2_repeater_log_xfer(er, EUSB2_XFER_BULK_WRITE, reg, len, ret, j);
+			if (!ret)
+				break;
+			dev_err(er->dev, "failed to write %d regs from reg: 0x%02x ret=%d\n",
+				len, reg, ret);
+		}
+		if (ret)
+			return ret;
+
+		/* continue the walk after the run */
+		reg += len - 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read back the tuning registers in @used. Runs of them are fetched with
+ * one transfer each, a run also covers registers nobody asked for unless
+ * they are map holes or read sensitive. Registers which do not read back
+ * as expected are flagged in @bad_regs, returns their count.
+ */
+static int eusb2_repeater_tune_verify(struct eusb2_repeater *er,
+		const struct eusb2_tune_table *t, const unsigned long *used,
+		unsigned long *bad_regs)
+{
+	u8 rd[EUSB2_REG_CNT];
+	int first, last, reg, len, bad = 0, ret = 0;
+
+	/*
+	 * Nothing to read back from a chip that is off or held in reset, the
+	 * writes wait in the cache and cache_restore() puts them out.
+	 */
+	if (!eusb2_repeater_accessible(er))
+		return 0;
+
+	first = find_first_bit(used, EUSB2_REG_CNT);
+	if (first >= EUSB2_REG_CNT)
+		return 0;
+	last = find_last_bit(used, EUSB2_REG_CNT);
+
+	/*
+	 * Read back from the chip, the cache holds what was just written. A
+	 * bulk read of cached registers would go one register at a time, the
+	 * raw read honours the bypass and fetches a run in one transfer.
+	 */
+	usleep_range(1, 10);
+	regcache_cache_bypass(er->regmap, true);
+	for (reg = first; reg <= last && !ret; reg += len) {
+		len = 1;
+		if (!test_bit(reg, used))
+			continue;
+
+		while (reg + len <= last && (test_bit(reg + len, used) ||
+				(eusb2_repeater_reg_readable(er, reg + len) &&
+				 !eusb2_repeater_reg_precious(er, reg + len))))
+			len++;
+		while (!test_bit(reg + len - 1, used))
+			len--;
+
+		ret = regmap_raw_read(er->regmap, reg, &rd[reg], len);
+		eusb2_repeater_log_xfer(er, EUSB2_XFER_BULK_READ, reg, len, ret, 0);
+	}
+	regcache_cache_bypass(er->regmap, false);
+	if (ret) {
+		dev_err(er->dev, "Failed to read regs 0x%02x-0x%02x ret=%d\n",
+			first, last, ret);
+		return ret;
+	}
+
+	for_each_set_bit(reg, used, EUSB2_REG_CNT) {
+		if (eusb2_repeater_tune_skip(er, t, reg) || rd[reg] == t->val[reg])
+			continue;
+		dev_err(er->dev, "reg:0x%02x reads 0x%02x, expected 0x%02x\n",
+			reg, rd[reg], t->val[reg]);
+		__set_bit(reg, bad_regs);
+		bad++;
+	}
+	dev_dbg(er->dev, "verify %d regs 0x%02x-0x%02x, %d mismatch\n",
+		bitmap_weight(used, EUSB2_REG_CNT), first, last, bad);
+
+	return bad;
+}
+
+/* write and read back one register at a time, the pre-batching behaviour */
+static int eusb2_repeater_tune_write_verify(struct eusb2_repeater *er,
+		const struct eusb2_tune_table *t, const unsigned long *used)
+{
+	unsigned int reg_val;
+	int reg, j, ret;
+
+	/* as in tune_verify(), only the cache can take the writes for now */
+	if (!eusb2_repeater_accessible(er))
+		return eusb2_repeater_tune_write(er, t, used);
+
+	for_each_set_bit(reg, used, EUSB2_REG_CNT) {
+		if (eusb2_repeater_tune_skip(er, t, reg))
+			continue;
+
+		for (j = 0; j < 3; j++) {
+			ret = regmap_write(er->regmap, reg, t->val[reg]);
+			eusb2_repeater_log_xfer(er, EUSB2_XFER_WRITE, reg,
+					t->val[reg], ret, j);
+			if (ret)
+				continue;
+			usleep_range(1, 10);
+			regcache_cache_bypass(er->regmap, true);
+			ret = regmap_read(er->regmap, reg, &reg_val);
+			regcache_cache_bypass(er->regmap, false);
+			eusb2_repeater_log_xfer(er, EUSB2_XFER_READ, reg, reg_val, ret, j);
+			if (!ret && reg_val != t->val[reg])
+				ret = -EIO;
+			if (!ret)
+				break;
+		}
+		if (ret) {
+			dev_err(er->dev, "failed to set reg:0x%02x to 0x%02x ret=%d\n",
+				reg, t->val[reg], ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* apply the tuning registers in @used according to the verify policy */
+static int eusb2_repeater_tune_apply(struct eusb2_repeater *er,
+		const struct eusb2_tune_table *t, const unsigned long *used)
+{
+	DECLARE_BITMAP(pending, EUSB2_REG_CNT);
+	DECLARE_BITMAP(bad, EUSB2_REG_CNT);
+	int i, ret;
+
+	switch (READ_ONCE(er->tune_verify)) {
+	case EUSB2_TUNE_VERIFY_NONE:
+		return eusb2_repeater_tune_write(er, t, used);
+	case EUSB2_TUNE_VERIFY_PER_WRITE:
+		return eusb2_repeater_tune_write_verify(er, t, used);
+	default:
+		break;
+	}
+
+	/* write the whole set, then re-write only what did not stick */
+	bitmap_copy(pending, used, EUSB2_REG_CNT);
+	ret = eusb2_repeater_tune_write(er, t, pending);
+	for (i = 0; !ret; i++) {
+		bitmap_zero(bad, EUSB2_REG_CNT);
+		ret = eusb2_repeater_tune_verify(er, t, pending, bad);
+		if (ret <= 0 || i == 2)
+			break;
+		bitmap_copy(pending, bad, EUSB2_REG_CNT);
+		ret = eusb2_repeater_tune_write(er, t, pending);
+	}
+
+	return ret > 0 ? -EIO : ret;
+}
+
+/* replay the tuning table in register order, hw_lock held */
+static void eusb2_repeater_tune_set(struct eusb2_repeater *er)
+{
+	const struct eusb2_tune_table *t = eusb2_repeater_tune_table(er);
+
+	if (!bitmap_empty(t->used, EUSB2_REG_CNT))
+		eusb2_repeater_tune_apply(er, t, t->used);
+}
+
+static ssize_t eusb2_repeater_tune_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
+	const struct regmap_range *r;
+	u8 val[EUSB2_REG_CNT];
+	int i, n, cnt, len, ret;
+
+	if (!er) {
+		pr_err("eusb2 repeater is NULL\n");
+		return -ENODEV;
+	}
+
+	/*
+	 * hw_lock keeps these reads out of the cache bypass windows. A range
+	 * with cached registers in it is bulk read one register at a time,
+	 * only an all volatile range goes in one transfer.
+	 */
+	mutex_lock(&er->hw_lock);
+	for (i = 0, cnt = 0; i < er->chip->n_dump_ranges; i++) {
+		r = &er->chip->dump_ranges[i];
+		n = r->range_max - r->range_min + 1;
+		ret = regmap_bulk_read(er->regmap, r->range_min, &val[cnt], n);
+		if (ret < 0) {
+			mutex_unlock(&er->hw_lock);
+			dev_err(er->dev, "Failed to read reg:0x%02x ret=%d\n", r->range_min, ret);
+			return sysfs_emit(buf, "Failed to read reg\n");
+		}
+		cnt += n;
+	}
+	mutex_unlock(&er->hw_lock);
+
+	len = sysfs_emit(buf, "\n Address Value - %s\n", er->chip->name);
+	for (i = 0, cnt = 0; i < er->chip->n_dump_ranges; i++) {
+		r = &er->chip->dump_ranges[i];
+		for (n = r->range_min; n <= r->range_max; n++)
+			len += sysfs_emit_at(buf, len, "  0x%2x   0x%2x\n", n, val[cnt++]);
+	}
+	len += sysfs_emit_at(buf, len, "\n");
+
+	return len;
+}
+
+static ssize_t eusb2_repeater_tune_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t size)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
+	DECLARE_BITMAP(used, EUSB2_REG_CNT);
+	u8 tune_val[EUSB2_REG_CNT];
+	const struct eusb2_tune_table *t;
+	unsigned int reg, val;
+	unsigned int reg_val;
+	int ret;
+
+	if (!er) {
+		pr_err("eusb2 repeater is NULL\n");
+		return -ENODEV;
+	}
+	dev_dbg(er->dev, "%s buf=%s\n", __func__, buf);
+	if (sscanf(buf, "%x %x", &reg, &val) != 2 || reg > U8_MAX || val > U8_MAX ||
+			!eusb2_repeater_reg_writeable(er, reg))
+		return -EINVAL;
+
+	mutex_lock(&er->hw_lock);
+	ret = regmap_write(er->regmap, reg, val);
+	eusb2_repeater_log_xfer(er, EUSB2_XFER_WRITE, reg, val, ret, 0);
+	if (ret < 0) {
+		dev_err(er->dev, "failed to write 0x%02x to reg: 0x%02x ret=%d\n", val, reg, ret);
+		goto out;
+	}
+	bitmap_zero(used, EUSB2_REG_CNT);
+	__set_bit(reg, used);
+	tune_val[reg] = val;
+	t = eusb2_repeater_tune_update(er, used, tune_val);
+	if (!t) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* read back from the chip, a cached read would only echo the write */
+	if (!eusb2_repeater_accessible(er) || !eusb2_repeater_reg_readable(er, reg) ||
+			eusb2_repeater_reg_precious(er, reg))
+		goto out;
+
+	usleep_range(1, 2);
+	regcache_cache_bypass(er->regmap, true);
+	ret = regmap_read(er->regmap, reg, &reg_val);
+	regcache_cache_bypass(er->regmap, false);
+	eusb2_repeater_log_xfer(er, EUSB2_XFER_READ, reg, reg_val, ret, 0);
+	if (ret < 0) {
+		dev_err(er->dev, "Failed to read reg:0x%02x ret=%d\n", reg, ret);
+		goto out;
+	}
+	dev_dbg(er->dev, "%s(): 0x%x 0x%x (%d)\n", __func__, reg, reg_val,
+		bitmap_weight(t->used, EUSB2_REG_CNT));
+out:
+	mutex_unlock(&er->hw_lock);
+
+	return ret < 0 ? ret : size;
+}
+
+static DEVICE_ATTR_RW(eusb2_repeater_tune);
+
+/*
+ * Binary tuning upload: a whole set of (reg, val) byte pairs in a single
+ * write. The set is validated first, then merged into the tuning table,
+ * written in bursts and verified with one bulk read.
+ */
+static ssize_t eusb2_repeater_tune_bin_write(struct file *filp,
+		struct kobject *kobj, struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(kobj_to_dev(kobj));
+	DECLARE_BITMAP(used, EUSB2_REG_CNT);
+	const struct eusb2_tune_table *t;
+	u8 val[EUSB2_REG_CNT];
+	size_t i;
+	int reg, ret;
+
+	if (!er)
+		return -ENODEV;
+	if (off || !count || count % 2)
+		return -EINVAL;
+
+	bitmap_zero(used, EUSB2_REG_CNT);
+	for (i = 0; i < count; i += 2) {
+		reg = (u8)buf[i];
+		if (test_bit(reg, used)) {
+			dev_err(er->dev, "tune upload sets reg:0x%02x twice\n", reg);
+			return -EINVAL;
+		}
+		if (!eusb2_repeater_reg_writeable(er, reg)) {
+			dev_err(er->dev, "tune upload sets unwriteable reg:0x%02x\n", reg);
+			return -EINVAL;
+		}
+		val[reg] = buf[i + 1];
+		__set_bit(reg, used);
+	}
+
+	mutex_lock(&er->hw_lock);
+	t = eusb2_repeater_tune_update(er, used, val);
+	ret = t ? eusb2_repeater_tune_apply(er, t, used) : -ENOMEM;
+	mutex_unlock(&er->hw_lock);
+
+	return ret ? ret : count;
+}
+
+static BIN_ATTR_WO(eusb2_repeater_tune_bin, EUSB2_REG_CNT * 2);
+
+static ssize_t eusb2_repeater_tune_verify_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
+	int i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(eusb2_tune_verify_names); i++)
+		len += sysfs_emit_at(buf, len, i == READ_ONCE(er->tune_verify) ? "[%s] " : "%s ",
+				eusb2_tune_verify_names[i]);
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+static ssize_t eusb2_repeater_tune_verify_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t size)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
+	int ret;
+
+	ret = sysfs_match_string(eusb2_tune_verify_names, buf);
+	if (ret < 0)
+		return ret;
+
+	WRITE_ONCE(er->tune_verify, ret);
+
+	return size;
+}
+static DEVICE_ATTR_RW(eusb2_repeater_tune_verify);
+
+static struct attribute *eusb2_repeater_attributes[] = {
+	&dev_attr_eusb2_repeater_tune.attr,
+	&dev_attr_eusb2_repeater_tune_verify.attr,
+	NULL
+};
+
+static struct bin_attribute *eusb2_repeater_bin_attributes[] = {
+	&bin_attr_eusb2_repeater_tune_bin,
+	NULL
+};
+
+const struct attribute_group eusb2_repeater_sysfs_group = {
+	.attrs = eusb2_repeater_attributes,
+	.bin_attrs = eusb2_repeater_bin_attributes,
+};
+
+/* numbers the sec_class usb_repeater nodes of multiple repeaters */
+static DEFINE_IDA(eusb2_repeater_ida);
+#endif
+
+static int eusb2_repeater_power(struct eusb2_repeater *er, bool on)
+{
+	int ret = 0;
+
+	dev_dbg(er->ur.dev, "%s turn %s regulators. power_enabled:%d\n",
+			__func__, on ? "on" : "off", er->power_enabled);
+
+	if (er->power_enabled == on) {
+		dev_dbg(er->ur.dev, "regulators are already ON.\n");
+		return 0;
+	}
+
+	if (!on)
+		goto disable_vdd3;
+
+	/* voltages are configured once at probe, only vote for load here */
+	ret = regulator_set_load(er->vdd18, EUSB2_1P8_HPM_LOAD);
+	if (ret < 0) {
+		dev_err(er->ur.dev, "Unable to set HPM of vdd18:%d\n", ret);
+		return ret;
+	}
+
+	/* vdd18 must be up before vdd3 */
+	ret = regulator_enable(er->vdd18);
+	if (ret) {
+		dev_err(er->ur.dev, "Unable to enable vdd18:%d\n", ret);
+		goto put_vdd18_lpm;
+	}
+
+	ret = regulator_set_load(er->vdd3, EUSB2_3P0_HPM_LOAD);
+	if (ret < 0) {
+		dev_err(er->ur.dev, "Unable to set HPM of vdd3:%d\n", ret);
+		goto disable_vdd18;
+	}
+
+	ret = regulator_enable(er->vdd3);
+	if (ret) {
+		dev_err(er->ur.dev, "Unable to enable vdd3:%d\n", ret);
+		goto put_vdd3_lpm;
+	}
+
+	er->power_enabled = true;
+	pr_debug("%s(): eUSB2 repeater egulators are turned ON.\n", __func__);
+	return ret;
+
+disable_vdd3:
+	ret = regulator_disable(er->vdd3);
+	if (ret)
+		dev_err(er->ur.dev, "Unable to disable vdd3:%d\n", ret);
+
+put_vdd3_lpm:
+	if (regulator_set_load(er->vdd3, 0) < 0)
+		dev_err(er->ur.dev, "Unable to set (0) HPM of vdd3\n");
+
+disable_vdd18:
+	if (regulator_disable(er->vdd18))
+		dev_err(er->ur.dev, "Unable to disable vdd18\n");
+
+put_vdd18_lpm:
+	if (regulator_set_load(er->vdd18, 0) < 0)
+		dev_err(er->ur.dev, "Unable to set LPM of vdd18\n");
+
+	/* case handling when regulator turning on failed */
+	if (!er->power_enabled)
+		return ret;
+
+	er->power_enabled = false;
+	dev_dbg(er->ur.dev, "eUSB2 repeater's regulators are turned OFF.\n");
+	return ret;
+}
+
+/*
+ * Repeater loses its register contents across power off and reset. Keep
+ * serving reads from the cache meanwhile and write the cached state back
+ * once the chip is accessible again.
+ */
+static void eusb2_repeater_cache_invalidate(struct eusb2_repeater *er)
+{
+	er->programmed_seq = NULL;
+	regcache_cache_only(er->regmap, true);
+	regcache_mark_dirty(er->regmap);
+}
+
+static void eusb2_repeater_cache_restore(struct eusb2_repeater *er)
+{
+	int ret;
+
+	regcache_cache_only(er->regmap, false);
+	ret = regcache_sync(er->regmap);
+	eusb2_repeater_log_xfer(er, EUSB2_XFER_SYNC, 0, 0, ret, 0);
+	if (ret) {
+		dev_err(er->dev, "failed to sync register cache ret=%d\n", ret);
+		regcache_mark_dirty(er->regmap);
+	}
+}
+
+static enum hrtimer_restart eusb2_repeater_ready_timer(struct hrtimer *t)
+{
+	struct eusb2_repeater *er = container_of(t, struct eusb2_repeater, reset_timer);
+
+	complete(&er->reset_ready);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Chip was released from reset or powered on. Rather than sleeping the
+ * ready time here, let the caller carry on and have the first register
+ * access wait for whatever is left of it.
+ */
+static void eusb2_repeater_start_ready(struct eusb2_repeater *er)
+{
+	if (!er->reset_ready_us) {
+		er->reset_state = EUSB2_RESET_READY;
+		eusb2_repeater_cache_restore(er);
+		return;
+	}
+
+	hrtimer_cancel(&er->reset_timer);
+	reinit_completion(&er->reset_ready);
+	er->reset_state = EUSB2_RESET_RELEASING;
+	hrtimer_start(&er->reset_timer, us_to_ktime(er->reset_ready_us), HRTIMER_MODE_REL);
+}
+
+static void eusb2_repeater_wait_ready(struct eusb2_repeater *er)
+{
+	if (er->reset_state != EUSB2_RESET_RELEASING)
+		return;
+
+	wait_for_completion(&er->reset_ready);
+	er->reset_state = EUSB2_RESET_READY;
+	eusb2_repeater_cache_restore(er);
+}
+
+static int eusb2_repeater_init(struct usb_repeater *ur)
+{
+	struct eusb2_repeater *er =
+			container_of(ur, struct eusb2_repeater, ur);
+	struct eusb2_seq *seq = &er->override_seq;
+	struct eusb2_seq *update = seq;
+	int ret = 0;
+
+	trace_eusb2_repeater_op_start(dev_name(er->dev), "init", ur->is_host);
+
+	mutex_lock(&er->hw_lock);
+	eusb2_repeater_wait_ready(er);
+
+	/* override init sequence using devicetree based values */
+#if IS_ENABLED(CONFIG_USB_NOTIFIER)
+	if (er->host_override_seq.cnt && er->ur.is_host)
+		seq = update = &er->host_override_seq;
+
+	/* on a role swap only write what differs from the other role */
+	if (seq == &er->host_override_seq && er->programmed_seq == &er->override_seq)
+		update = &er->client_to_host_seq;
+	else if (seq == &er->override_seq && er->programmed_seq == &er->host_override_seq)
+		update = &er->host_to_client_seq;
+#endif
+	if (er->programmed_seq == seq)
+		dev_dbg(er->ur.dev, "override seq already programmed\n");
+	else if (update->cnt)
+		ret = eusb2_repeater_update_seq(er, update);
+	er->programmed_seq = ret ? NULL : seq;
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	if (er->er_tune_init_done)
+		eusb2_repeater_tune_set(er);
+#endif
+	mutex_unlock(&er->hw_lock);
+	dev_info(er->ur.dev, "eUSB2 repeater init\n");
+
+	trace_eusb2_repeater_op_end(dev_name(er->dev), "init", ret);
+	return 0;
+}
+
+/*
+ * The PHY asserts and releases reset on every init, often on a repeater
+ * that is already in the requested state. Only level changes reach the
+ * gpio, and the pulse width is counted from the assert so that time
+ * spent elsewhere in between is not slept again.
+ */
+static int eusb2_repeater_reset(struct usb_repeater *ur, bool bring_out_of_reset)
+{
+	struct eusb2_repeater *er =
+			container_of(ur, struct eusb2_repeater, ur);
+	s64 held;
+
+	trace_eusb2_repeater_op_start(dev_name(er->dev), "reset", bring_out_of_reset);
+	mutex_lock(&er->hw_lock);
+	if (bring_out_of_reset == (er->reset_state != EUSB2_RESET_ASSERTED)) {
+		er->reset_coalesced++;
+		dev_dbg(ur->dev, "reset gpio:%s coalesced\n",
+				bring_out_of_reset ? "release" : "assert");
+		goto out;
+	}
+
+	dev_dbg(ur->dev, "reset gpio:%s\n",
+			bring_out_of_reset ? "release" : "assert");
+	if (!bring_out_of_reset) {
+		hrtimer_cancel(&er->reset_timer);
+		eusb2_repeater_cache_invalidate(er);
+		/* edges we cause ourselves are not reported as unexpected resets */
+		WRITE_ONCE(er->reset_toggled, jiffies);
+		gpiod_set_value_cansleep(er->reset_gpiod, 0);
+		er->reset_asserted = ktime_get();
+		er->reset_state = EUSB2_RESET_ASSERTED;
+		er->reset_asserts++;
+		goto out;
+	}
+
+	held = ktime_us_delta(ktime_get(), er->reset_asserted);
+	if (held < (s64)er->reset_assert_us)
+		fsleep(er->reset_assert_us - held);
+
+	WRITE_ONCE(er->reset_toggled, jiffies);
+	gpiod_set_value_cansleep(er->reset_gpiod, 1);
+	er->reset_releases++;
+	eusb2_repeater_start_ready(er);
+out:
+	mutex_unlock(&er->hw_lock);
+	trace_eusb2_repeater_op_end(dev_name(er->dev), "reset", 0);
+	return 0;
+}
+
+/* hw_lock held */
+static int eusb2_repeater_do_powerdown(struct eusb2_repeater *er)
+{
+	er->powerdown_cnt++;
+	er->in_retention = false;
+	/* nothing left to wait for, powerup starts the ready time again */
+	if (er->reset_state == EUSB2_RESET_RELEASING) {
+		hrtimer_cancel(&er->reset_timer);
+		er->reset_state = EUSB2_RESET_READY;
+	}
+	eusb2_repeater_cache_invalidate(er);
+	return eusb2_repeater_power(er, false);
+}
+
+static void eusb2_repeater_powerdown_work(struct work_struct *w)
+{
+	struct eusb2_repeater *er = container_of(to_delayed_work(w),
+			struct eusb2_repeater, powerdown_work);
+	int ret;
+
+	mutex_lock(&er->hw_lock);
+	ret = eusb2_repeater_do_powerdown(er);
+	mutex_unlock(&er->hw_lock);
+	trace_eusb2_repeater_op_end(dev_name(er->dev), "powerdown_work", ret);
+}
+
+static int eusb2_repeater_powerdown(struct usb_repeater *ur)
+{
+	struct eusb2_repeater *er =
+			container_of(ur, struct eusb2_repeater, ur);
+	u32 delay = READ_ONCE(er->autosuspend_delay_ms);
+	int ret = 0;
+
+	trace_eusb2_repeater_op_start(dev_name(er->dev), "powerdown", delay);
+	if (!delay) {
+		mutex_lock(&er->hw_lock);
+		ret = eusb2_repeater_do_powerdown(er);
+		mutex_unlock(&er->hw_lock);
+	} else {
+		mod_delayed_work(system_wq, &er->powerdown_work, msecs_to_jiffies(delay));
+	}
+	trace_eusb2_repeater_op_end(dev_name(er->dev), "powerdown", ret);
+
+	return ret;
+}
+
+static int eusb2_repeater_set_load(struct eusb2_repeater *er, bool hpm)
+{
+	int ret;
+
+	ret = regulator_set_load(er->vdd18, hpm ? EUSB2_1P8_HPM_LOAD : EUSB2_1P8_LPM_LOAD);
+	if (ret < 0) {
+		dev_err(er->ur.dev, "Unable to set %s of vdd18:%d\n", hpm ? "HPM" : "LPM", ret);
+		return ret;
+	}
+
+	ret = regulator_set_load(er->vdd3, hpm ? EUSB2_3P0_HPM_LOAD : EUSB2_3P0_LPM_LOAD);
+	if (ret < 0) {
+		dev_err(er->ur.dev, "Unable to set %s of vdd3:%d\n", hpm ? "HPM" : "LPM", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/* marker written on retention entry did not survive: registers were reset */
+static bool eusb2_repeater_state_lost(struct eusb2_repeater *er)
+{
+	unsigned int val = 0;
+	int ret;
+
+	if (!er->chip->has_sig)
+		return true;
+
+	regcache_cache_bypass(er->regmap, true);
+	ret = regmap_read(er->regmap, er->chip->sig_reg, &val);
+	regcache_cache_bypass(er->regmap, false);
+	eusb2_repeater_log_xfer(er, EUSB2_XFER_READ, er->chip->sig_reg, val, ret, 0);
+
+	return ret < 0 || val != er->retention_sig;
+}
+
+/* hw_lock held */
+static int eusb2_repeater_do_retention(struct eusb2_repeater *er, bool enter)
+{
+	struct usb_repeater *ur = &er->ur;
+	bool lost = false;
+	int ret = 0;
+
+	trace_eusb2_repeater_op_start(dev_name(er->dev), "retention", enter);
+	eusb2_repeater_wait_ready(er);
+	if (enter) {
+		if (er->in_retention || !er->power_enabled)
+			goto out;
+
+		if (er->chip->has_sig) {
+			er->retention_sig++;
+			ret = regmap_write(er->regmap, er->chip->sig_reg, er->retention_sig);
+			eusb2_repeater_log_xfer(er, EUSB2_XFER_WRITE, er->chip->sig_reg,
+					er->retention_sig, ret, 0);
+			if (ret < 0)
+				dev_err(er->dev, "failed to write retention marker ret=%d\n", ret);
+		}
+
+		/* the chip is not accessed until retention exit */
+		regcache_cache_only(er->regmap, true);
+		eusb2_repeater_set_load(er, false);
+		er->in_retention = true;
+		dev_dbg(ur->dev, "entered retention\n");
+		ret = 0;
+		goto out;
+	}
+
+	if (!er->in_retention)
+		goto out;
+
+	ret = eusb2_repeater_set_load(er, true);
+	if (ret)
+		goto out;
+
+	er->in_retention = false;
+
+	/*
+	 * Put in reset while parked: the cache is already marked dirty and
+	 * stays cache only, start_ready() writes it back on release.
+	 */
+	if (er->reset_state != EUSB2_RESET_READY) {
+		lost = true;
+		er->retention_lost++;
+		dev_dbg(ur->dev, "exited retention in reset\n");
+		goto out;
+	}
+
+	regcache_cache_only(er->regmap, false);
+	lost = eusb2_repeater_state_lost(er);
+	if (lost) {
+		er->retention_lost++;
+		regcache_mark_dirty(er->regmap);
+	} else {
+		er->retention_kept++;
+	}
+
+	/*
+	 * Writes queued while in retention, or the whole programmed state if
+	 * it was lost, go out in one sync. Only fall back to a full init when
+	 * that fails.
+	 */
+	ret = regcache_sync(er->regmap);
+	eusb2_repeater_log_xfer(er, EUSB2_XFER_SYNC, 0, 0, ret, 0);
+	if (ret) {
+		dev_err(er->dev, "failed to restore registers ret=%d\n", ret);
+		er->programmed_seq = NULL;
+		regcache_mark_dirty(er->regmap);
+		ret = 0;
+	}
+
+	dev_dbg(ur->dev, "exited retention, state %s\n", lost ? "restored" : "kept");
+out:
+	trace_eusb2_repeater_op_end(dev_name(er->dev), "retention", ret ? ret : lost);
+	return ret;
+}
+
+static int eusb2_repeater_powerup(struct usb_repeater *ur)
+{
+	struct eusb2_repeater *er =
+			container_of(ur, struct eusb2_repeater, ur);
+	bool absorbed;
+	int ret = 0;
+
+	trace_eusb2_repeater_op_start(dev_name(er->dev), "powerup", er->power_enabled);
+
+	/* the powerdown work takes hw_lock, flush it first */
+	absorbed = cancel_delayed_work_sync(&er->powerdown_work);
+
+	mutex_lock(&er->hw_lock);
+	if (absorbed) {
+		er->powerdown_absorbed++;
+		dev_dbg(er->ur.dev, "powerdown absorbed (%u)\n", er->powerdown_absorbed);
+	}
+
+	/*
+	 * Rails are still up and registers programmed. After retention they
+	 * are at the LPM vote and the chip may have lost its state, leave
+	 * retention the same way the PHY would.
+	 */
+	if (er->power_enabled) {
+		if (er->in_retention)
+			ret = eusb2_repeater_do_retention(er, false);
+		goto out;
+	}
+
+	/* a repeater held in reset is restored once it is released */
+	ret = eusb2_repeater_power(er, true);
+	if (!ret && er->reset_state != EUSB2_RESET_ASSERTED)
+		eusb2_repeater_start_ready(er);
+out:
+	mutex_unlock(&er->hw_lock);
+	trace_eusb2_repeater_op_end(dev_name(er->dev), "powerup", ret);
+	return ret;
+}
+
+static int eusb2_repeater_retention(struct usb_repeater *ur, bool enter)
+{
+	struct eusb2_repeater *er =
+			container_of(ur, struct eusb2_repeater, ur);
+	int ret;
+
+	/* the powerdown work takes hw_lock, flush it first */
+	if (enter)
+		cancel_delayed_work_sync(&er->powerdown_work);
+
+	mutex_lock(&er->hw_lock);
+	ret = eusb2_repeater_do_retention(er, enter);
+	mutex_unlock(&er->hw_lock);
+
+	return ret;
+}
+
+/* read the pm_check registers from the chip, bypassing the cache */
+static int eusb2_repeater_pm_read_check(struct eusb2_repeater *er, u8 *val)
+{
+	unsigned int reg_val = 0;
+	int i, ret = 0;
+
+	regcache_cache_bypass(er->regmap, true);
+	for (i = 0; i < er->chip->n_pm_check; i++) {
+		ret = regmap_read(er->regmap, er->chip->pm_check[i], &reg_val);
+		eusb2_repeater_log_xfer(er, EUSB2_XFER_READ, er->chip->pm_check[i],
+				reg_val, ret, 0);
+		if (ret)
+			break;
+		val[i] = reg_val;
+	}
+	regcache_cache_bypass(er->regmap, false);
+
+	return ret;
+}
+
+static int __maybe_unused eusb2_repeater_pm_suspend(struct device *dev)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
+	bool pending;
+
+	/* a powerdown waiting for cable flapping to settle happens now */
+	pending = cancel_delayed_work_sync(&er->powerdown_work);
+
+	mutex_lock(&er->hw_lock);
+	if (pending)
+		eusb2_repeater_do_powerdown(er);
+
+	eusb2_repeater_wait_ready(er);
+	er->pm_snap_valid = false;
+	/* the register cache is the snapshot, keep the chip id and key regs */
+	if (eusb2_repeater_accessible(er) &&
+			!eusb2_repeater_pm_read_check(er, er->pm_snap))
+		er->pm_snap_valid = true;
+	mutex_unlock(&er->hw_lock);
+
+	return 0;
+}
+
+/*
+ * The chip stays powered across system suspend on most boards. Only
+ * restore it, with one cache sync, if the id or key registers changed.
+ */
+static int __maybe_unused eusb2_repeater_pm_resume(struct device *dev)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
+	u8 val[EUSB2_PM_CHECK_MAX];
+	int ret;
+
+	mutex_lock(&er->hw_lock);
+	if (!er->pm_snap_valid)
+		goto out;
+	er->pm_snap_valid = false;
+
+	/* held in reset since suspend, start_ready() restores it on release */
+	eusb2_repeater_wait_ready(er);
+	if (!eusb2_repeater_accessible(er))
+		goto out;
+
+	if (!eusb2_repeater_pm_read_check(er, val) &&
+			!memcmp(val, er->pm_snap, er->chip->n_pm_check)) {
+		er->resume_kept++;
+		goto out;
 	}
 
-	ret = regulator_enable(er->vdd18);
+	er->resume_restored++;
+	regcache_mark_dirty(er->regmap);
+	ret = regcache_sync(er->regmap);
+	eusb2_repeater_log_xfer(er, EUSB2_XFER_SYNC, 0, 0, ret, 0);
 	if (ret) {
-		dev_err(er->ur.dev, "Unable to enable vdd18:%d\n", ret);
-		goto unset_vdd18;
+		dev_err(er->dev, "failed to restore registers ret=%d\n", ret);
+		/* the PHY's next init replays the full sequence */
+		er->programmed_seq = NULL;
+		regcache_mark_dirty(er->regmap);
 	}
+	dev_dbg(dev, "state restored on resume\n");
+out:
+	mutex_unlock(&er->hw_lock);
 
-	ret = regulator_set_load(er->vdd3, EUSB2_3P0_HPM_LOAD);
-	if (ret < 0) {
-		dev_err(er->ur.dev, "Unable to set HPM of vdd3:%d\n", ret);
-		goto disable_vdd18;
-	}
+	return 0;
+}
 
-	ret = regulator_set_voltage(er->vdd3, EUSB2_3P0_VOL_MIN,
-						EUSB2_3P0_VOL_MAX);
-	if (ret) {
-		dev_err(er->ur.dev,
-				"Unable to set voltage for vdd3:%d\n", ret);
-		goto put_vdd3_lpm;
-	}
+static SIMPLE_DEV_PM_OPS(eusb2_repeater_pm_ops, eusb2_repeater_pm_suspend,
+		eusb2_repeater_pm_resume);
 
-	ret = regulator_enable(er->vdd3);
-	if (ret) {
-		dev_err(er->ur.dev, "Unable to enable vdd3:%d\n", ret);
-		goto unset_vdd3;
-	}
+static ssize_t autosuspend_delay_ms_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
 
-	er->power_enabled = true;
-	pr_debug("%s(): eUSB2 repeater egulators are turned ON.\n", __func__);
-	return ret;
+	return sysfs_emit(buf, "%u\n", READ_ONCE(er->autosuspend_delay_ms));
+}
 
-disable_vdd3:
-	ret = regulator_disable(er->vdd3);
-	if (ret)
-		dev_err(er->ur.dev, "Unable to disable vdd3:%d\n", ret);
+static ssize_t autosuspend_delay_ms_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t size)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
+	unsigned int delay;
+	int ret;
 
-unset_vdd3:
-	ret = regulator_set_voltage(er->vdd3, 0, EUSB2_3P0_VOL_MAX);
+	ret = kstrtouint(buf, 0, &delay);
 	if (ret)
-		dev_err(er->ur.dev,
-			"Unable to set (0) voltage for vdd3:%d\n", ret);
+		return ret;
 
-put_vdd3_lpm:
-	ret = regulator_set_load(er->vdd3, 0);
-	if (ret < 0)
-		dev_err(er->ur.dev, "Unable to set (0) HPM of vdd3\n");
+	WRITE_ONCE(er->autosuspend_delay_ms, delay);
+	return size;
+}
+static DEVICE_ATTR_RW(autosuspend_delay_ms);
 
-disable_vdd18:
-	ret = regulator_disable(er->vdd18);
-	if (ret)
-		dev_err(er->ur.dev, "Unable to disable vdd18:%d\n", ret);
+static ssize_t powerdown_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
 
-unset_vdd18:
-	ret = regulator_set_voltage(er->vdd18, 0, EUSB2_1P8_VOL_MAX);
-	if (ret)
-		dev_err(er->ur.dev,
-			"Unable to set (0) voltage for vdd18:%d\n", ret);
+	return sysfs_emit(buf, "powerdown:%u absorbed:%u retention:%u lost:%u resume_kept:%u resume_restored:%u\n",
+			er->powerdown_cnt, er->powerdown_absorbed,
+			er->retention_kept, er->retention_lost,
+			er->resume_kept, er->resume_restored);
+}
+static DEVICE_ATTR_RO(powerdown_stats);
 
-put_vdd18_lpm:
-	ret = regulator_set_load(er->vdd18, 0);
-	if (ret < 0)
-		dev_err(er->ur.dev, "Unable to set LPM of vdd18\n");
+static ssize_t unexpected_resets_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
 
-	/* case handling when regulator turning on failed */
-	if (!er->power_enabled)
-		return -EINVAL;
+	return sysfs_emit(buf, "%u\n", er->unexpected_resets);
+}
+static DEVICE_ATTR_RO(unexpected_resets);
+
+static ssize_t reset_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "assert:%u release:%u coalesced:%u assert_us:%u ready_us:%u\n",
+			er->reset_asserts, er->reset_releases, er->reset_coalesced,
+			er->reset_assert_us, er->reset_ready_us);
+}
+static DEVICE_ATTR_RO(reset_stats);
+
+static struct attribute *eusb2_repeater_pm_attributes[] = {
+	&dev_attr_autosuspend_delay_ms.attr,
+	&dev_attr_powerdown_stats.attr,
+	&dev_attr_unexpected_resets.attr,
+	&dev_attr_reset_stats.attr,
+	NULL
+};
+
+/* effective register image, to be stored where qcom,calib-firmware finds it */
+static ssize_t calib_blob_read(struct file *filp, struct kobject *kobj,
+		struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+	struct eusb2_repeater *er = dev_get_drvdata(kobj_to_dev(kobj));
+	ssize_t ret;
+	size_t len;
+	u8 *blob;
+
+	blob = kmalloc(EUSB2_CALIB_MAX_LEN, GFP_KERNEL);
+	if (!blob)
+		return -ENOMEM;
+
+	len = eusb2_calib_build(er, blob);
+	ret = memory_read_from_buffer(buf, count, &off, blob, len);
+	kfree(blob);
 
-err_vdd18:
-	er->power_enabled = false;
-	dev_dbg(er->ur.dev, "eUSB2 repeater's regulators are turned OFF.\n");
 	return ret;
 }
+static BIN_ATTR_RO(calib_blob, 0);
 
-static int eusb2_repeater_init(struct usb_repeater *ur)
+static struct bin_attribute *eusb2_repeater_pm_bin_attributes[] = {
+	&bin_attr_calib_blob,
+	NULL
+};
+
+static const struct attribute_group eusb2_repeater_pm_group = {
+	.attrs = eusb2_repeater_pm_attributes,
+	.bin_attrs = eusb2_repeater_pm_bin_attributes,
+};
+
+/*
+ * Readable registers, at most 16 per line with each line starting a new
+ * range. Runs between read sensitive registers are fetched with one bulk
+ * read each, read sensitive registers are skipped and shown as --.
+ */
+static int eusb2_repeater_regs_show(struct seq_file *s, void *unused)
 {
-	struct eusb2_repeater *er =
-			container_of(ur, struct eusb2_repeater, ur);
+	struct eusb2_repeater *er = s->private;
+	const struct regmap_access_table *rd = er->chip->rd_table;
+	const struct regmap_range *r;
+	u8 val[16];
+	int i, base, end, reg, len, ret;
 
-	/* override init sequence using devicetree based values */
-#if IS_ENABLED(CONFIG_USB_NOTIFIER)
-	if (er->param_host_override_seq_cnt && er->ur.is_host)
-		eusb2_repeater_update_seq(er, er->param_host_override_seq,
-					er->param_host_override_seq_cnt);
-	else
-#endif
-	if (er->param_override_seq_cnt)
-		eusb2_repeater_update_seq(er, er->param_override_seq,
-					er->param_override_seq_cnt);
-#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
-	if (er->tune_buf_cnt && er->er_tune_init_done)
-		eusb2_repeater_tune_set();
-#endif
-	dev_info(er->ur.dev, "eUSB2 repeater init\n");
+	/*
+	 * Show what the chip holds, not the cache, and do not fill the cache
+	 * with registers the driver never programs. The bypass is per map, so
+	 * nothing else may touch the chip meanwhile.
+	 */
+	mutex_lock(&er->hw_lock);
+	eusb2_repeater_wait_ready(er);
+	if (!eusb2_repeater_accessible(er)) {
+		seq_puts(s, "repeater not accessible\n");
+		goto out;
+	}
+
+	regcache_cache_bypass(er->regmap, true);
+	for (i = 0; i < rd->n_yes_ranges; i++) {
+		r = &rd->yes_ranges[i];
+		for (base = r->range_min; base <= r->range_max; base = end) {
+			end = min_t(int, base + ARRAY_SIZE(val), r->range_max + 1);
+			seq_printf(s, "%02x:", base);
+			for (reg = base; reg < end; reg += len) {
+				len = 1;
+				if (eusb2_repeater_reg_precious(er, reg)) {
+					seq_puts(s, " --");
+					continue;
+				}
+
+				while (reg + len < end && !eusb2_repeater_reg_precious(er, reg + len))
+					len++;
+				ret = regmap_raw_read(er->regmap, reg, val, len);
+				if (ret)
+					seq_printf(s, " read failed %d", ret);
+				else
+					seq_printf(s, " %*ph", len, val);
+			}
+			seq_putc(s, '\n');
+		}
+	}
+	regcache_cache_bypass(er->regmap, false);
+out:
+	mutex_unlock(&er->hw_lock);
 
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(eusb2_repeater_regs);
 
-static int eusb2_repeater_reset(struct usb_repeater *ur, bool bring_out_of_reset)
+/* transaction ring, oldest record first; racing writers may tear a line */
+static int eusb2_repeater_xfer_log_show(struct seq_file *s, void *unused)
 {
-	struct eusb2_repeater *er =
-			container_of(ur, struct eusb2_repeater, ur);
+	struct eusb2_repeater *er = s->private;
+	unsigned int head = atomic_read(&er->xfer_head);
+	unsigned int i = head > EUSB2_XFER_LOG_CNT ? head - EUSB2_XFER_LOG_CNT : 0;
+	struct eusb2_xfer_rec rec;
+
+	for (; i != head; i++) {
+		rec = er->xfer_log[i % EUSB2_XFER_LOG_CNT];
+		seq_printf(s, "%llu %-11s reg=0x%02x val=0x%02x ret=%d retry=%u\n",
+			rec.ts, eusb2_xfer_op_names[rec.op], rec.reg, rec.val,
+			rec.ret, rec.retry);
+	}
 
-	dev_dbg(ur->dev, "reset gpio:%s\n",
-			bring_out_of_reset ? "assert" : "deassert");
-	gpiod_set_value_cansleep(er->reset_gpiod, bring_out_of_reset);
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(eusb2_repeater_xfer_log);
 
-static int eusb2_repeater_powerup(struct usb_repeater *ur)
+/*
+ * The repeater went through a reset (ESD, brown-out) which was not
+ * requested through eusb2_repeater_reset(), its registers are back to
+ * their defaults. Restore the cached state in one sync and let the PHY
+ * know instead of running with a misconfigured link until the next
+ * disconnect.
+ */
+static irqreturn_t eusb2_reset_gpio_irq_thread(int irq, void *dev_id)
 {
-	struct eusb2_repeater *er =
-			container_of(ur, struct eusb2_repeater, ur);
+	struct eusb2_repeater *er = dev_id;
+	int ret;
+
+	if (time_before(jiffies, READ_ONCE(er->reset_toggled) +
+				msecs_to_jiffies(EUSB2_RESET_IRQ_IGNORE_MS))) {
+		dev_dbg(er->ur.dev, "reset gpio interrupt handled\n");
+		return IRQ_HANDLED;
+	}
+
+	mutex_lock(&er->hw_lock);
+	er->unexpected_resets++;
+	dev_warn(er->dev, "unexpected repeater reset (%u)\n", er->unexpected_resets);
+
+	/*
+	 * A chip held in reset by the PHY, or still inside its ready time,
+	 * gets the whole cache written back once it is released.
+	 */
+	if (eusb2_repeater_accessible(er)) {
+		regcache_mark_dirty(er->regmap);
+		ret = regcache_sync(er->regmap);
+		eusb2_repeater_log_xfer(er, EUSB2_XFER_SYNC, 0, 0, ret, 0);
+		if (ret) {
+			dev_err(er->dev, "failed to restore registers ret=%d\n", ret);
+			er->programmed_seq = NULL;
+		}
+	}
+	mutex_unlock(&er->hw_lock);
 
-	return eusb2_repeater_power(er, true);
+	usb_repeater_notify(&er->ur, USB_REPEATER_RESET_DETECTED);
+	return IRQ_HANDLED;
 }
 
-static int eusb2_repeater_powerdown(struct usb_repeater *ur)
+static void eusb2_repeater_late_init_work(struct work_struct *w)
 {
 	struct eusb2_repeater *er =
-			container_of(ur, struct eusb2_repeater, ur);
+			container_of(w, struct eusb2_repeater, late_init_work);
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	char name[16];
+#endif
+	int ret;
 
-	return eusb2_repeater_power(er, false);
+	devm_regmap_qti_debugfs_register(er->dev, er->regmap);
+
+	er->debugfs_root = debugfs_create_dir(dev_name(er->dev), NULL);
+	debugfs_create_file("regs", 0400, er->debugfs_root, er,
+			&eusb2_repeater_regs_fops);
+	debugfs_create_file("xfer_log", 0400, er->debugfs_root, er,
+			&eusb2_repeater_xfer_log_fops);
+
+	ret = devm_device_add_group(er->dev, &eusb2_repeater_pm_group);
+	if (ret)
+		dev_err(er->dev, "failed to create pm sysfs group ret=%d\n", ret);
+
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	/* the first repeater keeps the legacy usb_repeater node name */
+	if (er->tune_id)
+		scnprintf(name, sizeof(name), "usb_repeater%d", er->tune_id);
+	else
+		scnprintf(name, sizeof(name), "usb_repeater");
+
+	er->tune_dev = sec_device_create(er, name);
+	if (IS_ERR(er->tune_dev)) {
+		pr_err("%s Failed to create device(%s)!\n", __func__, name);
+		er->tune_dev = NULL;
+		return;
+	}
+
+	ret = sysfs_create_group(&er->tune_dev->kobj, &eusb2_repeater_sysfs_group);
+	if (ret) {
+		pr_err("%s: %s sysfs_create_group fail, ret %d", __func__, name, ret);
+		sec_device_destroy(er->tune_dev->devt);
+		er->tune_dev = NULL;
+	}
+#endif
 }
 
-static irqreturn_t eusb2_reset_gpio_irq_handler(int irq, void *dev_id)
+/* host test mode setting, it would break USB client mode */
+static bool eusb2_nxp_skip_write(struct eusb2_repeater *er, u8 reg, u8 val)
 {
-	/*
-	 * This IRQ handler is just returning IRQ_HANDLED to notify
-	 * interrupt framework to clear the interrupt.
-	 */
-	struct eusb2_repeater *er = dev_id;
-
-	dev_dbg(er->ur.dev, "reset gpio interrupt handled\n");
-	return IRQ_HANDLED;
+	return !er->ur.is_host && reg == LINK_CONTROL1 && val == 0x03;
 }
 
-static struct i2c_repeater_chip repeater_chip[] = {
+static const struct i2c_repeater_chip_ops eusb2_nxp_ops = {
+	.skip_write = eusb2_nxp_skip_write,
+};
+
+static const struct i2c_repeater_chip repeater_chip[] = {
 	[NXP_REPEATER] = {
-		.repeater_type = NXP_REPEATER,
+		.name = "NXP",
+		.rd_table = &eusb2_nxp_rd_table,
+		.wr_table = &eusb2_nxp_wr_table,
+		.volatile_table = &eusb2_nxp_volatile_table,
+		.has_sig = true,
+		.sig_reg = RAP_SIGNATURE,
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+		.dump_ranges = eusb2_nxp_dump_ranges,
+		.n_dump_ranges = ARRAY_SIZE(eusb2_nxp_dump_ranges),
+#endif
+		.pm_check = { RAP_SIGNATURE, REVISION_ID, LINK_CONTROL1, USB2_TX_CONTROL1 },
+		.n_pm_check = 4,
+		.ops = &eusb2_nxp_ops,
 	},
 	[TI_REPEATER] = {
-		.repeater_type = TI_REPEATER,
+		.name = "TI",
+		.rd_table = &eusb2_ti_rd_table,
+		.wr_table = &eusb2_ti_wr_table,
+		.volatile_table = &eusb2_ti_volatile_table,
+		.precious_table = &eusb2_ti_precious_table,
+		.pm_check = { REV_ID, GLOBAL_CONFIG, INT_ENABLE_1, INT_ENABLE_2 },
+		.n_pm_check = 4,
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+		.dump_ranges = eusb2_ti_dump_ranges,
+		.n_dump_ranges = ARRAY_SIZE(eusb2_ti_dump_ranges),
+#endif
 	}
 };
 
@@ -576,35 +2284,149 @@ static const struct of_device_id eusb2_repeater_id_table[] = {
 };
 MODULE_DEVICE_TABLE(of, eusb2_repeater_id_table);
 
+static void eusb2_repeater_regmap_config(struct eusb2_repeater *er,
+		struct regmap_config *cfg)
+{
+	*cfg = eusb2_i2c_regmap;
+	cfg->rd_table = er->chip->rd_table;
+	cfg->wr_table = er->chip->wr_table;
+	cfg->volatile_table = er->chip->volatile_table;
+	cfg->precious_table = er->chip->precious_table;
+}
+
+/*
+ * Locks, work and timers are set up before anything, interrupts included,
+ * can reach the driver.
+ */
+static struct eusb2_repeater *eusb2_repeater_alloc(struct device *dev)
+{
+	struct eusb2_repeater *er;
+
+	er = devm_kzalloc(dev, sizeof(*er), GFP_KERNEL);
+	if (!er)
+		return NULL;
+
+	er->dev = dev;
+	mutex_init(&er->hw_lock);
+	INIT_DELAYED_WORK(&er->powerdown_work, eusb2_repeater_powerdown_work);
+	init_completion(&er->reset_ready);
+	hrtimer_init(&er->reset_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	er->reset_timer.function = eusb2_repeater_ready_timer;
+
+	return er;
+}
+
+/*
+ * Bus independent part of probe and remove: @er has its chip, regmap,
+ * supplies and override sequences set up.
+ */
+static int eusb2_repeater_register(struct eusb2_repeater *er)
+{
+	int ret;
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	struct eusb2_tune_table *t;
+	int i;
+#endif
+
+	/* the reset gpio is requested low, keeping the chip in reset */
+	er->reset_state = er->reset_gpiod ? EUSB2_RESET_ASSERTED : EUSB2_RESET_READY;
+	er->reset_asserted = ktime_get();
+
+	er->ur.dev = er->dev;
+
+	er->ur.init		= eusb2_repeater_init;
+	er->ur.reset		= eusb2_repeater_reset;
+	er->ur.powerup		= eusb2_repeater_powerup;
+	er->ur.powerdown	= eusb2_repeater_powerdown;
+	er->ur.retention	= eusb2_repeater_retention;
+
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	/* tuning state must be ready before the first init callback */
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+	for (i = 0; i < er->calib_tune_cnt; i++) {
+		t->val[er->calib_tune[i].reg] = er->calib_tune[i].val;
+		__set_bit(er->calib_tune[i].reg, t->used);
+	}
+	RCU_INIT_POINTER(er->tune, t);
+
+	er->tune_id = ida_alloc(&eusb2_repeater_ida, GFP_KERNEL);
+	if (er->tune_id < 0) {
+		ret = er->tune_id;
+		goto err_tune;
+	}
+	er->tune_verify = EUSB2_TUNE_VERIFY_BATCH;
+	er->er_tune_init_done = true;
+#endif
+
+	ret = usb_add_repeater_dev(&er->ur);
+	if (ret) {
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+		ida_free(&eusb2_repeater_ida, er->tune_id);
+		goto err_tune;
+#endif
+		return ret;
+	}
+
+	return 0;
+
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+err_tune:
+	RCU_INIT_POINTER(er->tune, NULL);
+	kfree(t);
+	return ret;
+#endif
+}
+
+/* no more ops once removed, then nothing can queue powerdown work */
+static void eusb2_repeater_unregister(struct eusb2_repeater *er)
+{
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	struct eusb2_tune_table *t;
+#endif
+
+	usb_remove_repeater_dev(&er->ur);
+	cancel_delayed_work_sync(&er->powerdown_work);
+	mutex_lock(&er->hw_lock);
+	hrtimer_cancel(&er->reset_timer);
+	eusb2_repeater_power(er, false);
+	mutex_unlock(&er->hw_lock);
+#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
+	/* calib_blob and the interrupts stay until devres runs */
+	t = rcu_replace_pointer(er->tune, NULL, true);
+	if (t)
+		kfree_rcu(t, rcu);
+	ida_free(&eusb2_repeater_ida, er->tune_id);
+#endif
+}
+
 static int eusb2_repeater_i2c_probe(struct i2c_client *client)
 {
 	struct eusb2_repeater *er;
 	struct device *dev = &client->dev;
 	const struct of_device_id *match;
-	int ret = 0, num_elem;
-#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
-	struct device *eusb2_repeater_device;
-#endif
+	struct regmap_config regmap_cfg;
+	int ret = 0;
 
 	pr_info("%s\n", __func__);
-	er = devm_kzalloc(dev, sizeof(*er), GFP_KERNEL);
+	er = eusb2_repeater_alloc(dev);
 	if (!er) {
 		ret = -ENOMEM;
 		goto err_probe;
 	}
 
-	er->dev = dev;
 	match = of_match_node(eusb2_repeater_id_table, dev->of_node);
 	er->chip = match->data;
 
-	er->regmap = devm_regmap_init_i2c(client, &eusb2_i2c_regmap);
-	if (!er->regmap) {
+	eusb2_repeater_regmap_config(er, &regmap_cfg);
+	er->regmap = devm_regmap_init_i2c(client, &regmap_cfg);
+	if (IS_ERR(er->regmap)) {
 		dev_err(dev, "failed to allocate register map\n");
-		ret = -EINVAL;
+		ret = PTR_ERR(er->regmap);
 		goto err_probe;
 	}
 
-	devm_regmap_qti_debugfs_register(er->dev, er->regmap);
 	i2c_set_clientdata(client, er);
 
 	ret = of_property_read_u16(dev->of_node, "reg", &er->reg_base);
@@ -613,17 +2435,27 @@ static int eusb2_repeater_i2c_probe(struct i2c_client *client)
 		goto err_probe;
 	}
 
-	er->vdd3 = devm_regulator_get(dev, "vdd3");
-	if (IS_ERR(er->vdd3)) {
-		dev_err(dev, "unable to get vdd3 supply\n");
-		ret = PTR_ERR(er->vdd3);
+	er->supplies[EUSB2_VDD18].supply = "vdd18";
+	er->supplies[EUSB2_VDD3].supply = "vdd3";
+	ret = devm_regulator_bulk_get(dev, EUSB2_NUM_SUPPLIES, er->supplies);
+	if (ret) {
+		dev_err(dev, "unable to get vdd18/vdd3 supplies\n");
+		goto err_probe;
+	}
+	er->vdd18 = er->supplies[EUSB2_VDD18].consumer;
+	er->vdd3 = er->supplies[EUSB2_VDD3].consumer;
+
+	ret = regulator_set_voltage(er->vdd18, EUSB2_1P8_VOL_MIN,
+						EUSB2_1P8_VOL_MAX);
+	if (ret) {
+		dev_err(dev, "Unable to set voltage for vdd18:%d\n", ret);
 		goto err_probe;
 	}
 
-	er->vdd18 = devm_regulator_get(dev, "vdd18");
-	if (IS_ERR(er->vdd18)) {
-		dev_err(dev, "unable to get vdd18 supply\n");
-		ret = PTR_ERR(er->vdd18);
+	ret = regulator_set_voltage(er->vdd3, EUSB2_3P0_VOL_MIN,
+						EUSB2_3P0_VOL_MAX);
+	if (ret) {
+		dev_err(dev, "Unable to set voltage for vdd3:%d\n", ret);
 		goto err_probe;
 	}
 
@@ -632,6 +2464,14 @@ static int eusb2_repeater_i2c_probe(struct i2c_client *client)
 		ret = PTR_ERR(er->reset_gpiod);
 		goto err_probe;
 	}
+	er->reset_toggled = jiffies;
+
+	er->reset_assert_us = er->chip->reset_assert_us;
+	er->reset_ready_us = er->chip->reset_ready_us;
+	of_property_read_u32(dev->of_node, "qcom,reset-assert-us", &er->reset_assert_us);
+	of_property_read_u32(dev->of_node, "qcom,reset-ready-us", &er->reset_ready_us);
+	if (er->reset_gpiod && !er->reset_ready_us)
+		dev_dbg(dev, "no qcom,reset-ready-us, chip is accessed right after reset release\n");
 
 	er->reset_gpio_irq = of_irq_get_byname(dev->of_node, "eusb2_rptr_reset_gpio_irq");
 	if (er->reset_gpio_irq < 0) {
@@ -640,101 +2480,55 @@ static int eusb2_repeater_i2c_probe(struct i2c_client *client)
 		goto err_probe;
 	}
 
-	ret = devm_request_irq(dev, er->reset_gpio_irq,
-			eusb2_reset_gpio_irq_handler, IRQF_TRIGGER_RISING,
+	ret = devm_request_threaded_irq(dev, er->reset_gpio_irq, NULL,
+			eusb2_reset_gpio_irq_thread, IRQF_TRIGGER_RISING | IRQF_ONESHOT,
 			client->name, er);
 	if (ret < 0) {
 		dev_err(dev, "failed to request reset gpio irq\n");
 		goto err_probe;
 	}
 
-	num_elem = of_property_count_elems_of_size(dev->of_node, "qcom,param-override-seq",
-				sizeof(*er->param_override_seq));
-	if (num_elem > 0) {
-		if (num_elem % 2) {
-			dev_err(dev, "invalid param_override_seq_len\n");
-			ret = -EINVAL;
-			goto err_probe;
-		}
+	of_property_read_u32(dev->of_node, "qcom,autosuspend-delay-ms",
+			&er->autosuspend_delay_ms);
 
-		er->param_override_seq_cnt = num_elem;
-		er->param_override_seq = devm_kcalloc(dev,
-				er->param_override_seq_cnt,
-				sizeof(*er->param_override_seq), GFP_KERNEL);
-		if (!er->param_override_seq) {
-			ret = -ENOMEM;
+	/* a saved calibration replaces both DT override sequences */
+	if (eusb2_repeater_calib_load(er)) {
+		ret = eusb2_repeater_parse_seq(er, "qcom,param-override-seq",
+				&er->override_seq, true);
+		if (ret)
 			goto err_probe;
-		}
 
-		ret = of_property_read_u8_array(dev->of_node,
-				"qcom,param-override-seq",
-				er->param_override_seq,
-				er->param_override_seq_cnt);
-		if (ret) {
-			dev_err(dev, "qcom,param-override-seq read failed %d\n",
-									ret);
+#if IS_ENABLED(CONFIG_USB_NOTIFIER)
+		ret = eusb2_repeater_parse_seq(er, "qcom,param-host-override-seq",
+				&er->host_override_seq, false);
+		if (ret)
 			goto err_probe;
-		}
+#endif
 	}
 
 #if IS_ENABLED(CONFIG_USB_NOTIFIER)
-	num_elem = of_property_count_elems_of_size(dev->of_node, "qcom,param-host-override-seq",
-				sizeof(*er->param_host_override_seq));
-	if (num_elem > 0) {
-		if (num_elem % 2) {
-			dev_err(dev, "invalid param_host_override_seq_len\n");
-			ret = -EINVAL;
-			goto err_probe;
-		}
-
-		er->param_host_override_seq_cnt = num_elem;
-		er->param_host_override_seq = devm_kcalloc(dev,
-				er->param_host_override_seq_cnt,
-				sizeof(*er->param_host_override_seq), GFP_KERNEL);
-		if (!er->param_host_override_seq) {
-			ret = -ENOMEM;
+	if (er->host_override_seq.cnt) {
+		ret = eusb2_repeater_diff_seq(er, &er->override_seq,
+				&er->host_override_seq, &er->client_to_host_seq);
+		if (ret)
 			goto err_probe;
-		}
 
-		ret = of_property_read_u8_array(dev->of_node,
-				"qcom,param-host-override-seq",
-				er->param_host_override_seq,
-				er->param_host_override_seq_cnt);
-		if (ret) {
-			dev_err(dev, "qcom,param-host-override-seq read failed %d\n",
-									ret);
+		ret = eusb2_repeater_diff_seq(er, &er->host_override_seq,
+				&er->override_seq, &er->host_to_client_seq);
+		if (ret)
 			goto err_probe;
-		}
 	}
 #endif
 
-	er->ur.dev = dev;
-
-	er->ur.init		= eusb2_repeater_init;
-	er->ur.reset		= eusb2_repeater_reset;
-	er->ur.powerup		= eusb2_repeater_powerup;
-	er->ur.powerdown	= eusb2_repeater_powerdown;
-
-	ret = usb_add_repeater_dev(&er->ur);
+	ret = eusb2_repeater_register(er);
 	if (ret)
 		goto err_probe;
 
-#if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
-	ter = er;
-	er->tune_buf_cnt = 0;
-	er->er_tune_init_done = true;
-	eusb2_repeater_tune_buf_init();
-	mutex_init(&er->er_tune_lock);
-	eusb2_repeater_device = sec_device_create(NULL, "usb_repeater");
-	if (IS_ERR(eusb2_repeater_device))
-		pr_err("%s Failed to create device(usb_repeater)!\n", __func__);
-
+	/* debug and tuning interfaces are not needed to bring up USB */
+	INIT_WORK(&er->late_init_work, eusb2_repeater_late_init_work);
+	schedule_work(&er->late_init_work);
 
-	ret = sysfs_create_group(&eusb2_repeater_device->kobj, &eusb2_repeater_sysfs_group);
-	if (ret)
-		pr_err("%s: usb_repeater sysfs_create_group fail, ret %d", __func__, ret);
-#endif
-	pr_info("%s %s done\n", __func__, er->chip->repeater_type ? "NXP":"TI");
+	pr_info("%s %s done\n", __func__, er->chip->name);
 	return 0;
 
 err_probe:
@@ -748,11 +2542,15 @@ static int eusb2_repeater_i2c_remove(struct i2c_client *client)
 
 	if (!er)
 		return 0;
+	cancel_work_sync(&er->late_init_work);
+	debugfs_remove_recursive(er->debugfs_root);
 #if IS_ENABLED(CONFIG_USB_PHY_TUNING_QCOM)
-	mutex_destroy(&er->er_tune_lock);
+	if (er->tune_dev) {
+		sysfs_remove_group(&er->tune_dev->kobj, &eusb2_repeater_sysfs_group);
+		sec_device_destroy(er->tune_dev->devt);
+	}
 #endif
-	usb_remove_repeater_dev(&er->ur);
-	eusb2_repeater_power(er, false);
+	eusb2_repeater_unregister(er);
 	return 0;
 }
 
@@ -762,10 +2560,16 @@ static struct i2c_driver eusb2_i2c_repeater_driver = {
 	.driver = {
 		.name	= "eusb2-repeater",
 		.of_match_table = of_match_ptr(eusb2_repeater_id_table),
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+		.pm = &eusb2_repeater_pm_ops,
 	},
 };
 
 module_i2c_driver(eusb2_i2c_repeater_driver);
 
+#if IS_ENABLED(CONFIG_I2C_EUSB2_REPEATER_KUNIT_TEST)
+#include "kunit/test_repeater_i2c_eusb2.c"
+#endif
+
 MODULE_DESCRIPTION("eUSB2 i2c repeater driver");
 MODULE_LICENSE("GPL v2");
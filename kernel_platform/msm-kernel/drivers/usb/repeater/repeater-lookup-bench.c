@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Lookup scaling benchmark for the usb repeater framework
+ *
+ * Registers a set of synthetic repeaters and runs lookup and put loops on
+ * an increasing number of CPUs, optionally while another thread keeps
+ * adding and removing a repeater. Results are printed when the module is
+ * loaded, e.g.
+ *
+ *   insmod repeater-lookup-bench.ko nr_repeaters=16 duration_ms=1000
+ */
+
+#include <linux/cpumask.h>
+#include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/slab.h>
+#include <linux/usb/repeater.h>
+
+static unsigned int nr_repeaters = 16;
+module_param(nr_repeaters, uint, 0444);
+MODULE_PARM_DESC(nr_repeaters, "number of synthetic repeaters");
+
+static unsigned int nr_threads;
+module_param(nr_threads, uint, 0444);
+MODULE_PARM_DESC(nr_threads, "maximum number of lookup threads, 0 for all online cpus");
+
+static unsigned int duration_ms = 1000;
+module_param(duration_ms, uint, 0444);
+MODULE_PARM_DESC(duration_ms, "run time of each step");
+
+static bool churn = true;
+module_param(churn, bool, 0444);
+MODULE_PARM_DESC(churn, "add and remove a repeater while lookups run");
+
+struct bench_repeater {
+	struct usb_repeater	ur;
+	struct device_node	node;
+};
+
+struct bench_thread {
+	struct task_struct	*task;
+	struct device		*consumer;
+	unsigned int		seed;
+	u64			lookups;
+	u64			misses;
+	u64			total_ns;
+	u64			max_ns;
+};
+
+struct bench_churn {
+	struct task_struct	*task;
+	u64			cycles;
+	u64			add_ns;
+	u64			add_max_ns;
+	u64			remove_ns;
+	u64			remove_max_ns;
+};
+
+/* lookups pin the owner of the repeater's driver */
+static struct device_driver bench_driver = {
+	.name	= "usb_repeater_bench",
+	.owner	= THIS_MODULE,
+};
+
+static struct bench_repeater *bench_rep;
+static struct bench_thread *bench_thr;
+static struct bench_churn bench_ch;
+
+static int bench_lookup_fn(void *data)
+{
+	struct bench_thread *th = data;
+	struct usb_repeater *r;
+	ktime_t start;
+	u64 ns;
+	void *grp;
+	int i;
+
+	while (!kthread_should_stop()) {
+		/* spread lookups over all repeaters, and the churned one */
+		th->seed = th->seed * 1103515245 + 12345;
+		i = (th->seed >> 16) % (nr_repeaters + churn);
+
+		start = ktime_get();
+		grp = devres_open_group(th->consumer, NULL, GFP_KERNEL);
+		r = devm_usb_get_repeater_by_node(th->consumer, &bench_rep[i].node);
+		devres_release_group(th->consumer, grp);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		th->lookups++;
+		if (IS_ERR(r))
+			th->misses++;
+		th->total_ns += ns;
+		th->max_ns = max(th->max_ns, ns);
+
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/* repeater_lock is held across add and remove, that is what lookups race */
+static int bench_churn_fn(void *data)
+{
+	struct bench_repeater *b = &bench_rep[nr_repeaters];
+	ktime_t start;
+	u64 ns;
+
+	while (!kthread_should_stop()) {
+		start = ktime_get();
+		usb_add_repeater_dev(&b->ur);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		bench_ch.add_ns += ns;
+		bench_ch.add_max_ns = max(bench_ch.add_max_ns, ns);
+
+		usleep_range(100, 200);
+
+		start = ktime_get();
+		usb_remove_repeater_dev(&b->ur);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		bench_ch.remove_ns += ns;
+		bench_ch.remove_max_ns = max(bench_ch.remove_max_ns, ns);
+
+		bench_ch.cycles++;
+		usleep_range(100, 200);
+	}
+
+	return 0;
+}
+
+static int bench_run(unsigned int threads)
+{
+	u64 lookups = 0, misses = 0, total_ns = 0, max_ns = 0;
+	struct bench_thread *th;
+	unsigned int i;
+	int cpu = -1, ret = 0;
+
+	memset(&bench_ch, 0, sizeof(bench_ch));
+	for (i = 0; i < threads; i++) {
+		th = &bench_thr[i];
+		th->lookups = th->misses = th->total_ns = th->max_ns = 0;
+		th->seed = i + 1;
+
+		th->task = kthread_create(bench_lookup_fn, th, "rptr_bench/%u", i);
+		if (IS_ERR(th->task)) {
+			ret = PTR_ERR(th->task);
+			threads = i;
+			goto stop;
+		}
+
+		/* one thread per cpu, wrapping around if asked for more */
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+		kthread_bind(th->task, cpu);
+	}
+
+	if (churn) {
+		bench_ch.task = kthread_run(bench_churn_fn, NULL, "rptr_bench_churn");
+		if (IS_ERR(bench_ch.task)) {
+			ret = PTR_ERR(bench_ch.task);
+			bench_ch.task = NULL;
+			goto stop;
+		}
+	}
+
+	for (i = 0; i < threads; i++)
+		wake_up_process(bench_thr[i].task);
+
+	msleep(duration_ms);
+
+stop:
+	for (i = 0; i < threads; i++) {
+		th = &bench_thr[i];
+		kthread_stop(th->task);
+		lookups += th->lookups;
+		misses += th->misses;
+		total_ns += th->total_ns;
+		max_ns = max(max_ns, th->max_ns);
+	}
+	if (bench_ch.task)
+		kthread_stop(bench_ch.task);
+
+	if (ret)
+		return ret;
+
+	pr_info("%u threads: %llu lookups/s, %llu misses, avg %llu ns, max %llu ns\n",
+		threads, div_u64(lookups * MSEC_PER_SEC, duration_ms), misses,
+		lookups ? div64_u64(total_ns, lookups) : 0, max_ns);
+	if (bench_ch.cycles)
+		pr_info("%u threads: %llu add/remove, add avg %llu max %llu ns, remove avg %llu max %llu ns\n",
+			threads, bench_ch.cycles,
+			div64_u64(bench_ch.add_ns, bench_ch.cycles), bench_ch.add_max_ns,
+			div64_u64(bench_ch.remove_ns, bench_ch.cycles),
+			bench_ch.remove_max_ns);
+
+	return 0;
+}
+
+static void bench_cleanup(unsigned int nr_rep, unsigned int nr_thr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_thr; i++)
+		root_device_unregister(bench_thr[i].consumer);
+
+	for (i = 0; i < nr_rep; i++) {
+		if (i < nr_repeaters)
+			usb_remove_repeater_dev(&bench_rep[i].ur);
+		bench_rep[i].ur.dev->driver = NULL;
+		bench_rep[i].ur.dev->of_node = NULL;
+		root_device_unregister(bench_rep[i].ur.dev);
+	}
+
+	kfree(bench_thr);
+	kfree(bench_rep);
+}
+
+static int __init usb_repeater_bench_init(void)
+{
+	struct bench_repeater *b;
+	struct device *dev;
+	unsigned int i, n, t = 0, threads;
+	char name[32];
+	int ret;
+
+	threads = nr_threads ? nr_threads : num_online_cpus();
+
+	/* the last repeater is the one being churned */
+	bench_rep = kcalloc(nr_repeaters + 1, sizeof(*bench_rep), GFP_KERNEL);
+	bench_thr = kcalloc(threads, sizeof(*bench_thr), GFP_KERNEL);
+	if (!bench_rep || !bench_thr) {
+		kfree(bench_rep);
+		kfree(bench_thr);
+		return -ENOMEM;
+	}
+
+	for (n = 0; n < nr_repeaters + 1; n++) {
+		b = &bench_rep[n];
+		scnprintf(name, sizeof(name), "usb_repeater_bench%u", n);
+		dev = root_device_register(name);
+		if (IS_ERR(dev)) {
+			ret = PTR_ERR(dev);
+			goto err;
+		}
+		dev->of_node = &b->node;
+		dev->driver = &bench_driver;
+		b->ur.dev = dev;
+
+		if (n == nr_repeaters)
+			continue;
+
+		ret = usb_add_repeater_dev(&b->ur);
+		if (ret) {
+			b->ur.dev = NULL;
+			root_device_unregister(dev);
+			goto err;
+		}
+	}
+
+	for (t = 0; t < threads; t++) {
+		scnprintf(name, sizeof(name), "usb_repeater_bench_user%u", t);
+		bench_thr[t].consumer = root_device_register(name);
+		if (IS_ERR(bench_thr[t].consumer)) {
+			ret = PTR_ERR(bench_thr[t].consumer);
+			goto err;
+		}
+	}
+
+	pr_info("%u repeaters, %u ms per step, churn %s\n", nr_repeaters,
+		duration_ms, churn ? "on" : "off");
+
+	/* 1, 2, 4, ... threads, and the maximum */
+	for (i = 1; ; i = min(i * 2, threads)) {
+		ret = bench_run(i);
+		if (ret || i == threads)
+			break;
+	}
+
+err:
+	bench_cleanup(n, t);
+	return ret;
+}
+
+static void __exit usb_repeater_bench_exit(void)
+{
+}
+
+module_init(usb_repeater_bench_init);
+module_exit(usb_repeater_bench_exit);
+
+MODULE_DESCRIPTION("USB repeater lookup benchmark");
+MODULE_LICENSE("GPL v2");
@@ -2,16 +2,53 @@
 /*
  * Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
  */
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/err.h>
 #include <linux/export.h>
+#include <linux/hashtable.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
 #include <linux/of.h>
+#include <linux/rculist.h>
 #include <linux/usb/repeater.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
-static LIST_HEAD(repeater_list);
-static DEFINE_SPINLOCK(repeater_lock);
+/*
+ * Registered repeaters are hashed by their device node. Lookups walk the
+ * table under RCU only, repeater_lock serializes add and remove against
+ * each other and against notifier registration, so that a consumer never
+ * misses or sees a stale USB_REPEATER_ADD event.
+ */
+#define REPEATER_HASH_BITS	4
+
+/* usb_repeater::init_flags, set from queueing until the result is posted */
+#define USB_REPEATER_INIT_QUEUED	0
+
+static DEFINE_HASHTABLE(repeater_hash, REPEATER_HASH_BITS);
+static DEFINE_MUTEX(repeater_lock);
+static BLOCKING_NOTIFIER_HEAD(repeater_notifier);
+
+/* bumped on every registration to wake up consumers waiting for one */
+static atomic_t repeater_gen = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(repeater_wq);
+
+/* usb_repeater/<dev>/stats, created with the first repeater */
+static struct dentry *repeater_debugfs_root;
+
+static const char * const usb_repeater_op_names[USB_REPEATER_OP_CNT] = {
+	[USB_REPEATER_OP_RESET]		= "reset",
+	[USB_REPEATER_OP_INIT]		= "init",
+	[USB_REPEATER_OP_SUSPEND]	= "suspend",
+	[USB_REPEATER_OP_POWERUP]	= "powerup",
+	[USB_REPEATER_OP_POWERDOWN]	= "powerdown",
+	[USB_REPEATER_OP_RETENTION]	= "retention",
+};
 
 void usb_put_repeater(struct usb_repeater *r)
 {
@@ -23,6 +60,7 @@ void usb_put_repeater(struct usb_repeater *r)
 }
 EXPORT_SYMBOL(usb_put_repeater);
 
+/* must be called under rcu_read_lock() */
 static struct usb_repeater *of_usb_find_repeater(struct device_node *node)
 {
 	struct usb_repeater *r;
@@ -30,7 +68,7 @@ static struct usb_repeater *of_usb_find_repeater(struct device_node *node)
 	if (!of_device_is_available(node))
 		return ERR_PTR(-ENODEV);
 
-	list_for_each_entry(r, &repeater_list, head) {
+	hash_for_each_possible_rcu(repeater_hash, r, hash_node, (unsigned long)node) {
 		if (node != r->dev->of_node)
 			continue;
 		return r;
@@ -49,7 +87,6 @@ struct usb_repeater *devm_usb_get_repeater_by_node(struct device *dev,
 {
 	struct usb_repeater *r = ERR_PTR(-ENOMEM);
 	struct usb_repeater *r_devm;
-	unsigned long flags;
 
 	r_devm = devres_alloc(devm_usb_repeater_release_by_node,
 					sizeof(*r_devm), GFP_KERNEL);
@@ -58,7 +95,7 @@ struct usb_repeater *devm_usb_get_repeater_by_node(struct device *dev,
 		return r;
 	}
 
-	spin_lock_irqsave(&repeater_lock, flags);
+	rcu_read_lock();
 	r = of_usb_find_repeater(node);
 	if (IS_ERR(r)) {
 		devres_free(r_devm);
@@ -74,11 +111,41 @@ struct usb_repeater *devm_usb_get_repeater_by_node(struct device *dev,
 	devres_add(dev, r_devm);
 	get_device(r->dev);
 err0:
-	spin_unlock_irqrestore(&repeater_lock, flags);
+	rcu_read_unlock();
 	return r;
 }
 EXPORT_SYMBOL(devm_usb_get_repeater_by_node);
 
+/**
+ * devm_usb_get_repeater_by_node_timeout - get repeater, waiting for it
+ * @dev: device requesting the repeater
+ * @node: device node of the repeater
+ * @timeout: time to wait for the repeater to register, in jiffies
+ *
+ * Same as devm_usb_get_repeater_by_node() but instead of failing with
+ * -EPROBE_DEFER right away, sleeps until the repeater registers or
+ * @timeout expires. Returns -EPROBE_DEFER on timeout.
+ */
+struct usb_repeater *devm_usb_get_repeater_by_node_timeout(struct device *dev,
+			struct device_node *node, unsigned long timeout)
+{
+	struct usb_repeater *r;
+	int gen;
+
+	do {
+		gen = atomic_read(&repeater_gen);
+		r = devm_usb_get_repeater_by_node(dev, node);
+		if (PTR_ERR(r) != -EPROBE_DEFER)
+			return r;
+
+		timeout = wait_event_timeout(repeater_wq,
+				atomic_read(&repeater_gen) != gen, timeout);
+	} while (timeout);
+
+	return r;
+}
+EXPORT_SYMBOL(devm_usb_get_repeater_by_node_timeout);
+
 struct usb_repeater *devm_usb_get_repeater_by_phandle(struct device *dev,
 	const char *phandle, u8 index)
 {
@@ -103,6 +170,291 @@ struct usb_repeater *devm_usb_get_repeater_by_phandle(struct device *dev,
 }
 EXPORT_SYMBOL(devm_usb_get_repeater_by_phandle);
 
+static void usb_repeater_stat_op(struct usb_repeater *r,
+		enum usb_repeater_op op, ktime_t start, int ret)
+{
+	struct usb_repeater_op_stats *s = &r->stats.op[op];
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	int bucket = 0;
+
+	if (us)
+		bucket = min_t(int, ilog2(us) + 1, USB_REPEATER_HIST_BUCKETS - 1);
+
+	spin_lock(&r->stats.lock);
+	s->calls++;
+	if (ret)
+		s->errors++;
+	s->total_ns += ns;
+	s->max_ns = max(s->max_ns, ns);
+	s->hist[bucket]++;
+
+	if (op == USB_REPEATER_OP_POWERDOWN && !ret) {
+		r->stats.powered_down = true;
+	} else if (op == USB_REPEATER_OP_POWERUP && !ret && r->stats.powered_down) {
+		r->stats.powered_down = false;
+		r->stats.power_cycles++;
+	}
+	spin_unlock(&r->stats.lock);
+}
+
+/**
+ * usb_repeater_stat_xfer - account a repeater register transfer
+ * @r: repeater the transfer went to
+ * @ret: result of the transfer
+ * @retry: attempt number, 0 for the first try
+ *
+ * Used by repeater drivers so that transfer errors and retries show up
+ * next to the op latencies.
+ */
+void usb_repeater_stat_xfer(struct usb_repeater *r, int ret, unsigned int retry)
+{
+	spin_lock(&r->stats.lock);
+	if (ret)
+		r->stats.xfer_errors++;
+	if (retry)
+		r->stats.xfer_retries++;
+	spin_unlock(&r->stats.lock);
+}
+EXPORT_SYMBOL(usb_repeater_stat_xfer);
+
+int usb_repeater_reset(struct usb_repeater *r, bool bring_out_of_reset)
+{
+	ktime_t start;
+	int ret;
+
+	if (!r || !r->reset)
+		return 0;
+
+	start = ktime_get();
+	ret = r->reset(r, bring_out_of_reset);
+	usb_repeater_stat_op(r, USB_REPEATER_OP_RESET, start, ret);
+	return ret;
+}
+EXPORT_SYMBOL(usb_repeater_reset);
+
+int usb_repeater_init(struct usb_repeater *r)
+{
+	ktime_t start;
+	int ret;
+
+	if (!r || !r->init)
+		return 0;
+
+	start = ktime_get();
+	ret = r->init(r);
+	usb_repeater_stat_op(r, USB_REPEATER_OP_INIT, start, ret);
+	return ret;
+}
+EXPORT_SYMBOL(usb_repeater_init);
+
+int usb_repeater_suspend(struct usb_repeater *r, int suspend)
+{
+	ktime_t start;
+	int ret;
+
+	if (!r || !r->suspend)
+		return 0;
+
+	start = ktime_get();
+	ret = r->suspend(r, suspend);
+	usb_repeater_stat_op(r, USB_REPEATER_OP_SUSPEND, start, ret);
+	return ret;
+}
+EXPORT_SYMBOL(usb_repeater_suspend);
+
+int usb_repeater_powerup(struct usb_repeater *r)
+{
+	ktime_t start;
+	int ret;
+
+	if (!r || !r->powerup)
+		return 0;
+
+	start = ktime_get();
+	ret = r->powerup(r);
+	usb_repeater_stat_op(r, USB_REPEATER_OP_POWERUP, start, ret);
+	return ret;
+}
+EXPORT_SYMBOL(usb_repeater_powerup);
+
+int usb_repeater_powerdown(struct usb_repeater *r)
+{
+	ktime_t start;
+	int ret;
+
+	if (!r || !r->powerdown)
+		return 0;
+
+	start = ktime_get();
+	ret = r->powerdown(r);
+	usb_repeater_stat_op(r, USB_REPEATER_OP_POWERDOWN, start, ret);
+	return ret;
+}
+EXPORT_SYMBOL(usb_repeater_powerdown);
+
+int usb_repeater_retention(struct usb_repeater *r, bool enter)
+{
+	ktime_t start;
+	int ret;
+
+	if (!r || !r->retention)
+		return 0;
+
+	start = ktime_get();
+	ret = r->retention(r, enter);
+	usb_repeater_stat_op(r, USB_REPEATER_OP_RETENTION, start, ret);
+	return ret;
+}
+EXPORT_SYMBOL(usb_repeater_retention);
+
+/**
+ * usb_repeater_power_get - take a power reference on the repeater
+ * @r: repeater to power up
+ *
+ * The first reference powers the repeater up, further ones only count
+ * users, so that e.g. the PHY and a charger detection path can share the
+ * repeater without redundant regulator calls. Users of the reference
+ * counted interface must not call usb_repeater_powerup() or
+ * usb_repeater_powerdown() directly.
+ */
+int usb_repeater_power_get(struct usb_repeater *r)
+{
+	int ret = 0;
+
+	if (!r)
+		return 0;
+
+	mutex_lock(&r->power_lock);
+	if (!r->power_users) {
+		ret = usb_repeater_powerup(r);
+		if (ret) {
+			mutex_unlock(&r->power_lock);
+			return ret;
+		}
+	}
+	r->power_users++;
+	mutex_unlock(&r->power_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL(usb_repeater_power_get);
+
+/**
+ * usb_repeater_power_put - drop a reference taken by usb_repeater_power_get()
+ * @r: repeater to power down
+ *
+ * The repeater is powered down when the last reference is dropped.
+ */
+int usb_repeater_power_put(struct usb_repeater *r)
+{
+	int ret = 0;
+
+	if (!r)
+		return 0;
+
+	mutex_lock(&r->power_lock);
+	if (WARN_ON(!r->power_users)) {
+		mutex_unlock(&r->power_lock);
+		return -EINVAL;
+	}
+
+	if (--r->power_users == 0)
+		ret = usb_repeater_powerdown(r);
+	mutex_unlock(&r->power_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL(usb_repeater_power_put);
+
+static int usb_repeater_stats_show(struct seq_file *s, void *unused)
+{
+	struct usb_repeater *r = s->private;
+	struct usb_repeater_op_stats *os;
+	int i, j;
+
+	seq_puts(s, "hist_us buckets: <1");
+	for (j = 1; j < USB_REPEATER_HIST_BUCKETS - 1; j++)
+		seq_printf(s, " <%u", 1U << j);
+	seq_printf(s, " >=%u\n", 1U << (USB_REPEATER_HIST_BUCKETS - 2));
+
+	spin_lock(&r->stats.lock);
+	for (i = 0; i < USB_REPEATER_OP_CNT; i++) {
+		os = &r->stats.op[i];
+		seq_printf(s, "%-10s calls %llu errors %llu avg_us %llu max_us %llu\n",
+			usb_repeater_op_names[i], os->calls, os->errors,
+			os->calls ? div64_u64(os->total_ns, os->calls * NSEC_PER_USEC) : 0,
+			div_u64(os->max_ns, NSEC_PER_USEC));
+		seq_puts(s, "  hist_us");
+		for (j = 0; j < USB_REPEATER_HIST_BUCKETS; j++)
+			seq_printf(s, " %llu", os->hist[j]);
+		seq_putc(s, '\n');
+	}
+	seq_printf(s, "xfer_errors %llu\nxfer_retries %llu\npower_cycles %llu\n",
+		r->stats.xfer_errors, r->stats.xfer_retries, r->stats.power_cycles);
+	spin_unlock(&r->stats.lock);
+	seq_printf(s, "power_users %u\n", READ_ONCE(r->power_users));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(usb_repeater_stats);
+
+static void usb_repeater_init_work(struct work_struct *w)
+{
+	struct usb_repeater *r = container_of(w, struct usb_repeater, init_work);
+
+	r->init_ret = usb_repeater_init(r);
+	/*
+	 * Drop the flag before waking waiters, so a caller that saw the result
+	 * can queue the next init without getting -EBUSY.
+	 */
+	smp_mb__before_atomic();
+	clear_bit(USB_REPEATER_INIT_QUEUED, &r->init_flags);
+	complete_all(&r->init_done);
+}
+
+/**
+ * usb_repeater_init_async - start repeater initialization in the background
+ * @r: repeater to initialize
+ *
+ * Queues the repeater init op on a workqueue, so that the caller can bring
+ * up its own hardware in the meantime. The caller must call
+ * usb_repeater_init_wait() before depending on the repeater being
+ * programmed and must not issue other repeater ops until then.
+ *
+ * Returns -EBUSY if a previous asynchronous init is still queued or running.
+ */
+int usb_repeater_init_async(struct usb_repeater *r)
+{
+	if (!r || !r->init)
+		return 0;
+
+	if (test_and_set_bit(USB_REPEATER_INIT_QUEUED, &r->init_flags))
+		return -EBUSY;
+
+	reinit_completion(&r->init_done);
+	queue_work(system_highpri_wq, &r->init_work);
+	return 0;
+}
+EXPORT_SYMBOL(usb_repeater_init_async);
+
+/**
+ * usb_repeater_init_wait - wait for usb_repeater_init_async() to finish
+ * @r: repeater being initialized
+ *
+ * Returns the result of the init op, or 0 if no asynchronous init was
+ * started.
+ */
+int usb_repeater_init_wait(struct usb_repeater *r)
+{
+	if (!r || !r->init)
+		return 0;
+
+	wait_for_completion(&r->init_done);
+	return r->init_ret;
+}
+EXPORT_SYMBOL(usb_repeater_init_wait);
+
 /**
  * usb_add_repeater_dev - Add repeater device
  * @r: repeater device available
@@ -118,9 +470,35 @@ int usb_add_repeater_dev(struct usb_repeater *r)
 		return -EINVAL;
 	}
 
-	spin_lock(&repeater_lock);
-	list_add_tail(&r->head, &repeater_list);
-	spin_unlock(&repeater_lock);
+	INIT_WORK(&r->init_work, usb_repeater_init_work);
+	init_completion(&r->init_done);
+	/* nothing to wait for until the first usb_repeater_init_async() */
+	complete_all(&r->init_done);
+	r->init_ret = 0;
+	r->init_flags = 0;
+
+	mutex_init(&r->power_lock);
+	r->power_users = 0;
+
+	spin_lock_init(&r->stats.lock);
+	memset(r->stats.op, 0, sizeof(r->stats.op));
+	r->stats.xfer_errors = 0;
+	r->stats.xfer_retries = 0;
+	r->stats.power_cycles = 0;
+	r->stats.powered_down = false;
+
+	mutex_lock(&repeater_lock);
+	if (!repeater_debugfs_root)
+		repeater_debugfs_root = debugfs_create_dir("usb_repeater", NULL);
+	r->debugfs = debugfs_create_dir(dev_name(r->dev), repeater_debugfs_root);
+	debugfs_create_file("stats", 0400, r->debugfs, r, &usb_repeater_stats_fops);
+
+	hash_add_rcu(repeater_hash, &r->hash_node, (unsigned long)r->dev->of_node);
+	blocking_notifier_call_chain(&repeater_notifier, USB_REPEATER_ADD, r);
+	mutex_unlock(&repeater_lock);
+
+	atomic_inc(&repeater_gen);
+	wake_up_all(&repeater_wq);
 
 	return 0;
 }
@@ -132,14 +510,83 @@ EXPORT_SYMBOL(usb_add_repeater_dev);
  */
 void usb_remove_repeater_dev(struct usb_repeater *r)
 {
-	unsigned long flags;
+	if (!r)
+		return;
+
+	mutex_lock(&repeater_lock);
+	hash_del_rcu(&r->hash_node);
+	blocking_notifier_call_chain(&repeater_notifier, USB_REPEATER_REMOVE, r);
+	debugfs_remove_recursive(r->debugfs);
+	r->debugfs = NULL;
+	mutex_unlock(&repeater_lock);
+
+	/* an init that was queued but never ran has no result to report */
+	if (cancel_work_sync(&r->init_work))
+		r->init_ret = -ENODEV;
+	smp_mb__before_atomic();
+	clear_bit(USB_REPEATER_INIT_QUEUED, &r->init_flags);
+	complete_all(&r->init_done);
 
-	spin_lock_irqsave(&repeater_lock, flags);
-	if (r)
-		list_del(&r->head);
-	spin_unlock_irqrestore(&repeater_lock, flags);
+	/* let lookups which may still see @r finish before it goes away */
+	synchronize_rcu();
 }
 EXPORT_SYMBOL(usb_remove_repeater_dev);
 
+/**
+ * usb_register_repeater_notifier - get notified about repeater registration
+ * @nb: notifier block called with USB_REPEATER_ADD or USB_REPEATER_REMOVE
+ *	and the struct usb_repeater as data
+ *
+ * Repeaters registered before @nb are replayed to it as USB_REPEATER_ADD
+ * events, so consumers can bind as soon as their repeater shows up instead
+ * of going through deferred probe.
+ */
+int usb_register_repeater_notifier(struct notifier_block *nb)
+{
+	struct usb_repeater *r;
+	int bkt, ret;
+
+	mutex_lock(&repeater_lock);
+	ret = blocking_notifier_chain_register(&repeater_notifier, nb);
+	if (!ret) {
+		hash_for_each(repeater_hash, bkt, r, hash_node)
+			nb->notifier_call(nb, USB_REPEATER_ADD, r);
+	}
+	mutex_unlock(&repeater_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL(usb_register_repeater_notifier);
+
+/**
+ * usb_unregister_repeater_notifier - stop repeater registration notifications
+ * @nb: notifier block passed to usb_register_repeater_notifier()
+ */
+int usb_unregister_repeater_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&repeater_notifier, nb);
+}
+EXPORT_SYMBOL(usb_unregister_repeater_notifier);
+
+/**
+ * usb_repeater_notify - report a repeater event to registered notifiers
+ * @r: repeater the event is about
+ * @event: one of enum usb_repeater_event
+ *
+ * Used by repeater drivers for events detected by the repeater itself,
+ * such as USB_REPEATER_RESET_DETECTED. May sleep.
+ */
+void usb_repeater_notify(struct usb_repeater *r, enum usb_repeater_event event)
+{
+	blocking_notifier_call_chain(&repeater_notifier, event, r);
+}
+EXPORT_SYMBOL(usb_repeater_notify);
+
+static void __exit usb_repeater_exit(void)
+{
+	debugfs_remove_recursive(repeater_debugfs_root);
+}
+module_exit(usb_repeater_exit);
+
 MODULE_DESCRIPTION("USB repeater framework");
 MODULE_LICENSE("GPL v2");
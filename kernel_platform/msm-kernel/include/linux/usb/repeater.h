@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+ */
+
+#ifndef __LINUX_USB_REPEATER_H
+#define __LINUX_USB_REPEATER_H
+
+#include <linux/bits.h>
+#include <linux/completion.h>
+#include <linux/err.h>
+#include <linux/errno.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#define UR_AUTO_RESUME_SUPPORTED	BIT(0)
+
+struct dentry;
+struct device;
+struct device_node;
+struct notifier_block;
+
+/* events of the repeater notifier, data is the struct usb_repeater */
+enum usb_repeater_event {
+	USB_REPEATER_ADD,
+	USB_REPEATER_REMOVE,
+	/* repeater was reset behind the PHY's back, state has been restored */
+	USB_REPEATER_RESET_DETECTED,
+};
+
+enum usb_repeater_op {
+	USB_REPEATER_OP_RESET,
+	USB_REPEATER_OP_INIT,
+	USB_REPEATER_OP_SUSPEND,
+	USB_REPEATER_OP_POWERUP,
+	USB_REPEATER_OP_POWERDOWN,
+	USB_REPEATER_OP_RETENTION,
+	USB_REPEATER_OP_CNT,
+};
+
+/* bucket 0 is below 1us, bucket n counts [2^(n-1), 2^n) us, last is open */
+#define USB_REPEATER_HIST_BUCKETS	16
+
+struct usb_repeater_op_stats {
+	u64		calls;
+	u64		errors;
+	u64		total_ns;
+	u64		max_ns;
+	u64		hist[USB_REPEATER_HIST_BUCKETS];
+};
+
+/* collected by the framework, see usb_repeater_stat_xfer() */
+struct usb_repeater_stats {
+	spinlock_t			lock;
+	struct usb_repeater_op_stats	op[USB_REPEATER_OP_CNT];
+	u64				xfer_errors;
+	u64				xfer_retries;
+	u64				power_cycles;
+	bool				powered_down;
+};
+
+struct usb_repeater {
+	struct device		*dev;
+	const char		*label;
+	unsigned int		flags;
+	bool			is_host;
+
+	/* entry in the framework lookup table, keyed by dev->of_node */
+	struct hlist_node	hash_node;
+
+	/* usb_repeater_init_async() state, owned by the framework */
+	struct work_struct	init_work;
+	struct completion	init_done;
+	int			init_ret;
+	unsigned long		init_flags;
+
+	struct usb_repeater_stats	stats;
+	struct dentry		*debugfs;
+
+	/* users sharing the repeater, see usb_repeater_power_get() */
+	struct mutex		power_lock;
+	unsigned int		power_users;
+
+	int	(*reset)(struct usb_repeater *x, bool bring_out_of_reset);
+	int	(*init)(struct usb_repeater *x);
+	int	(*suspend)(struct usb_repeater *r, int suspend);
+	int	(*powerup)(struct usb_repeater *x);
+	int	(*powerdown)(struct usb_repeater *x);
+	/* keep register state at minimal power instead of powering down */
+	int	(*retention)(struct usb_repeater *x, bool enter);
+};
+
+#if IS_ENABLED(CONFIG_USB_REPEATER)
+struct usb_repeater *devm_usb_get_repeater_by_phandle(struct device *dev,
+		const char *phandle, u8 index);
+struct usb_repeater *devm_usb_get_repeater_by_node(struct device *dev,
+		struct device_node *node);
+struct usb_repeater *devm_usb_get_repeater_by_node_timeout(struct device *dev,
+		struct device_node *node, unsigned long timeout);
+void usb_put_repeater(struct usb_repeater *r);
+int usb_add_repeater_dev(struct usb_repeater *r);
+void usb_remove_repeater_dev(struct usb_repeater *r);
+int usb_register_repeater_notifier(struct notifier_block *nb);
+int usb_unregister_repeater_notifier(struct notifier_block *nb);
+void usb_repeater_notify(struct usb_repeater *r, enum usb_repeater_event event);
+int usb_repeater_init_async(struct usb_repeater *r);
+int usb_repeater_init_wait(struct usb_repeater *r);
+void usb_repeater_stat_xfer(struct usb_repeater *r, int ret, unsigned int retry);
+
+int usb_repeater_reset(struct usb_repeater *r, bool bring_out_of_reset);
+int usb_repeater_init(struct usb_repeater *r);
+int usb_repeater_suspend(struct usb_repeater *r, int suspend);
+int usb_repeater_powerup(struct usb_repeater *r);
+int usb_repeater_powerdown(struct usb_repeater *r);
+int usb_repeater_retention(struct usb_repeater *r, bool enter);
+int usb_repeater_power_get(struct usb_repeater *r);
+int usb_repeater_power_put(struct usb_repeater *r);
+#else
+static inline struct usb_repeater *devm_usb_get_repeater_by_phandle(
+		struct device *d, const char *phandle, u8 index)
+{
+	return ERR_PTR(-ENXIO);
+}
+
+static inline struct usb_repeater *devm_usb_get_repeater_by_node(
+		struct device *dev, struct device_node *node)
+{
+	return ERR_PTR(-ENXIO);
+}
+
+static inline struct usb_repeater *devm_usb_get_repeater_by_node_timeout(
+		struct device *dev, struct device_node *node,
+		unsigned long timeout)
+{
+	return ERR_PTR(-ENXIO);
+}
+
+static inline void usb_put_repeater(struct usb_repeater *r)
+{ }
+
+static inline int usb_add_repeater_dev(struct usb_repeater *r)
+{
+	return 0;
+}
+
+static inline void usb_remove_repeater_dev(struct usb_repeater *r)
+{ }
+
+static inline int usb_register_repeater_notifier(struct notifier_block *nb)
+{
+	return -ENXIO;
+}
+
+static inline int usb_unregister_repeater_notifier(struct notifier_block *nb)
+{
+	return 0;
+}
+
+static inline void usb_repeater_notify(struct usb_repeater *r,
+		enum usb_repeater_event event)
+{ }
+
+static inline int usb_repeater_init_async(struct usb_repeater *r)
+{
+	return r && r->init ? r->init(r) : 0;
+}
+
+static inline int usb_repeater_init_wait(struct usb_repeater *r)
+{
+	return 0;
+}
+
+static inline void usb_repeater_stat_xfer(struct usb_repeater *r, int ret,
+		unsigned int retry)
+{ }
+
+static inline int usb_repeater_reset(struct usb_repeater *r,
+				bool bring_out_of_reset)
+{
+	if (r && r->reset != NULL)
+		return r->reset(r, bring_out_of_reset);
+	else
+		return 0;
+}
+
+static inline int usb_repeater_init(struct usb_repeater *r)
+{
+	if (r && r->init != NULL)
+		return r->init(r);
+	else
+		return 0;
+}
+
+static inline int usb_repeater_suspend(struct usb_repeater *r, int suspend)
+{
+	if (r && r->suspend != NULL)
+		return r->suspend(r, suspend);
+	else
+		return 0;
+}
+
+static inline int usb_repeater_powerup(struct usb_repeater *r)
+{
+	if (r && r->powerup != NULL)
+		return r->powerup(r);
+	else
+		return 0;
+}
+
+static inline int usb_repeater_powerdown(struct usb_repeater *r)
+{
+	if (r && r->powerdown != NULL)
+		return r->powerdown(r);
+	else
+		return 0;
+}
+
+static inline int usb_repeater_retention(struct usb_repeater *r, bool enter)
+{
+	if (r && r->retention != NULL)
+		return r->retention(r, enter);
+	else
+		return 0;
+}
+
+static inline int usb_repeater_power_get(struct usb_repeater *r)
+{
+	return usb_repeater_powerup(r);
+}
+
+static inline int usb_repeater_power_put(struct usb_repeater *r)
+{
+	return usb_repeater_powerdown(r);
+}
+#endif
+
+#endif /* __LINUX_USB_REPEATER_H */